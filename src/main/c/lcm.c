@@ -1,9 +1,32 @@
 #include "lcm.h"
+#include "lcmcache.h"
+#include "lcmcapture.h"
+#include "lcmcodec.h"
+#include "lcmjit.h"
+#include "lcmlog.h"
 #include "lcmlua.h"
+#include "lcmperf.h"
+#include "lcmprof.h"
+#include "lcmstate.h"
+#include "lcmtime.h"
+#include "lcmtrace.h"
 #include "lauxlib.h"
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#define LCM_STATE_METAFIELD_CACHE "cache"
+#define LCM_STATE_METAFIELD_CACHED "cached"
+#define LCM_STATE_METAFIELD_CODECS "codecs"
+#define LCM_STATE_METAFIELD_INFOS "infos"
 #define LCM_STATE_METAFIELD_LAMBDAS "lambdas"
+#define LCM_STATE_METAFIELD_LOG "log"
+#define LCM_STATE_METAFIELD_PERF "perf"
+#define LCM_STATE_METAFIELD_SCRATCH "scratch"
+#define LCM_STATE_METAFIELD_SHADOWS "shadows"
+#define LCM_STATE_METAFIELD_STATES "states"
+#define LCM_STATE_METAFIELD_TRACE "trace"
 #define LCM_STATE_METATYPE "LCM.state"
 #define LCM_STATE_NAME "lcm"
 
@@ -15,19 +38,117 @@
 typedef struct {
     int32_t lambda_id;
     int32_t batch_id;
+    int active; ///< Set while a lambda program or function is running.
+    int depth; ///< Number of batches being processed, counting nested calls.
     lcm_ClosureLog closure_log;
+    lcm_ClosureLogBatch closure_log_batch;
+    lcm_LogBuffer* log_buffer;
+    int log_defer;
+    int log_level;
+    lcm_Cache* cache;
+    lcm_Codecs* codecs;
+    lcm_ClosureWrite capture;
+    int capture_status; ///< Status of failed capture write, if any.
+    lcm_Perf* perf;
+    int jit_attached;
+    int warmup;
+#ifdef LCM_USE_TRACE
+    lcm_Trace* trace;
+#endif
 } lcm_State;
 
+/**
+ * LCM lambda information.
+ *
+ * Holds lambda properties that must be known outside of Lua.
+ */
+typedef struct {
+    int32_t lambda_id;
+    uint32_t flags;
+    lcm_JitStats jit;
+    lcm_PerfStats perf;
+} lcm_LambdaInfo;
+
+/** Batch processed by vector lambda. */
+typedef struct {
+    int status;
+    int input; ///< Index of batch among lambda inputs, or `0` if not passed.
+} lcm_GroupEntry;
+
+/**
+ * Looks up information about identified lambda, using LCM state object at
+ * stack index `index`. Returns NULL if no such lambda is registered.
+ */
+static lcm_LambdaInfo* lcm_lambdainfo(lua_State* L, int index, int32_t id);
+
+/**
+ * Processes `count` batches in `bs`, all having the same lambda ID, using LCM
+ * state object `state` located at stack index `index`, and provides any
+ * results to the function in the closure at the same index in `cs`. The
+ * lambda function and information are looked up once for all batches.
+ *
+ * Writes the status of each batch to `statuses`, if not NULL, and returns the
+ * number of batches successfully processed.
+ */
+static size_t lcm_processrun(lua_State* L, lcm_State* state, int index,
+    const lcm_Batch* bs, const lcm_ClosureBatch* cs, int* statuses,
+    size_t count);
+
+/**
+ * Processes batch `b` with the lambda function at stack index `function`,
+ * which is not a function if no such lambda is registered, and provides any
+ * results to the function in closure `c`. `info` is NULL if no such lambda is
+ * registered.
+ */
+static int lcm_processone(lua_State* L, lcm_State* state, int index,
+    int function, lcm_LambdaInfo* info, const lcm_Batch b, lcm_ClosureBatch c);
+
+/**
+ * Processes batches as `lcm_processrun()`, passing all of them to the vector
+ * lambda function at stack index `function` in a single Lua call.
+ */
+static size_t lcm_processgroup(lua_State* L, lcm_State* state, int index,
+    int function, lcm_LambdaInfo* info, const lcm_Batch* bs,
+    const lcm_ClosureBatch* cs, int* statuses, size_t count);
+
+/** Delivers any log entries buffered in provided state, if not NULL. */
+static void lcm_logflush(lcm_State* state);
+
+/**
+ * Counts LuaJIT trace events. Attached via `jit.attach()` with the LCM state
+ * object as upvalue.
+ */
+static int lcm_jitevent(lua_State* L);
+
+/** Discards batch results. */
+static void lcm_discard(void* context, const lcm_Batch* result);
+
 LCM_API void lcm_openlib(lua_State* L, const lcm_Config* c)
 {
+    const lcm_Config config = c != NULL ? *c : (lcm_Config){
+        .closure_log = {.context = NULL, .function = NULL },
+    };
+
     // Create global LCM state object.
+    lcm_State* state;
     {
-        lcm_State* state = lua_newuserdata(L, sizeof(lcm_State));
+        state = lua_newuserdata(L, sizeof(lcm_State));
         state->batch_id = 0;
         state->lambda_id = 0;
-        if (c != NULL) {
-            state->closure_log = c->closure_log;
-        }
+        state->active = 0;
+        state->depth = 0;
+        state->closure_log = config.closure_log;
+        state->closure_log_batch = config.log_buffer.closure;
+        state->log_buffer = NULL;
+        state->log_defer = config.log_buffer.defer;
+        state->log_level = config.log_level;
+        state->cache = NULL;
+        state->codecs = NULL;
+        state->capture = config.capture;
+        state->capture_status = 0;
+        state->perf = NULL;
+        state->jit_attached = 0;
+        state->warmup = 0;
     }
     // Attach Lua meta table to state object.
     luaL_newmetatable(L, LCM_STATE_METATYPE);
@@ -40,12 +161,76 @@ LCM_API void lcm_openlib(lua_State* L, const lcm_Config* c)
 
             lua_pushcfunction(L, lcm_l_log);
             lua_setfield(L, -2, "log");
+
+            lua_pushcfunction(L, lcm_l_state);
+            lua_setfield(L, -2, "state");
+
+            // Add log level constants.
+            lua_pushinteger(L, LCM_LOG_DEBUG);
+            lua_setfield(L, -2, "DEBUG");
+            lua_pushinteger(L, LCM_LOG_INFO);
+            lua_setfield(L, -2, "INFO");
+            lua_pushinteger(L, LCM_LOG_WARN);
+            lua_setfield(L, -2, "WARN");
+            lua_pushinteger(L, LCM_LOG_ERROR);
+            lua_setfield(L, -2, "ERROR");
         }
         lua_setfield(L, -2, "__index");
 
         // Create lambdas table.
         lua_newtable(L);
         lua_setfield(L, -2, LCM_STATE_METAFIELD_LAMBDAS);
+
+        // Create lambda information table.
+        lua_newtable(L);
+        lua_setfield(L, -2, LCM_STATE_METAFIELD_INFOS);
+
+        // Create lambda state tables, and table of their checkpoint copies.
+        lua_newtable(L);
+        lua_setfield(L, -2, LCM_STATE_METAFIELD_STATES);
+        lua_newtable(L);
+        lua_setfield(L, -2, LCM_STATE_METAFIELD_SHADOWS);
+
+        // Create log buffer, if enabled.
+        if (config.log_buffer.closure.function != NULL) {
+            state->log_buffer = lcm_logbuffer_new(L,
+                config.log_buffer.size > 0 ? config.log_buffer.size
+                                           : LCM_LOG_BUFFER_SIZE);
+            lua_setfield(L, -2, LCM_STATE_METAFIELD_LOG);
+        }
+
+        // Create result cache, if enabled.
+        if (config.cache.capacity > 0) {
+            state->cache = lcm_cache_new(L, config.cache.capacity);
+            lua_setfield(L, -3, LCM_STATE_METAFIELD_CACHED);
+            lua_setfield(L, -2, LCM_STATE_METAFIELD_CACHE);
+        }
+
+        // Copy codecs, if any.
+        if (config.codecs.count > 0) {
+            state->codecs = lcm_codecs_new(
+                L, config.codecs.list, config.codecs.count);
+            lua_setfield(L, -2, LCM_STATE_METAFIELD_CODECS);
+            lua_createtable(L, 2, 0);
+            lua_setfield(L, -2, LCM_STATE_METAFIELD_SCRATCH);
+        }
+
+        // Open hardware counters, if enabled and available.
+        if (config.perf) {
+            state->perf = lcm_perf_new(L);
+            if (state->perf != NULL) {
+                lua_setfield(L, -2, LCM_STATE_METAFIELD_PERF);
+            }
+        }
+
+#ifdef LCM_USE_TRACE
+        // Create trace ring buffer.
+        state->trace = lua_newuserdata(L, sizeof(lcm_Trace));
+        state->trace->head = 0;
+        state->trace->count = 0;
+        state->trace->overwritten = 0;
+        lua_setfield(L, -2, LCM_STATE_METAFIELD_TRACE);
+#endif
     }
     lua_setmetatable(L, -2);
 
@@ -59,26 +244,51 @@ LCM_API int lcm_register(lua_State* L, const lcm_Lambda l)
     int status = 0;
 
     // Save job identifier to Lua registry.
+    lcm_State* state = NULL;
     {
         lua_getglobal(L, LCM_STATE_NAME);
         if (lua_type(L, -1) != LUA_TUSERDATA) {
             status = LCM_ERRINIT;
             goto end;
         }
-        lcm_State* state = luaL_checkudata(L, -1, LCM_STATE_METATYPE);
+        state = luaL_checkudata(L, -1, LCM_STATE_METATYPE);
         state->lambda_id = l.lambda_id;
         state->batch_id = 0;
+        state->active = 1;
+
+        // Discard any results cached by a previous lambda with the same ID.
+        if (state->cache != NULL) {
+            luaL_getmetafield(L, -1, LCM_STATE_METAFIELD_CACHED);
+            lcm_cache_invalidate(L, state->cache, -1, l.lambda_id);
+            lua_pop(L, 1);
+        }
     }
     // Load job into Lua state and execute it.
     {
+        LCM_TRACE_MARK(mark);
         const char* buffer = l.program.lua;
         const size_t size = l.program.length;
-        if ((status = luaL_loadbuffer(L, buffer, size, "lambda")) != 0) {
+
+        // Name chunk after lambda, making it show up in errors and profiles.
+        char name[32];
+        snprintf(name, sizeof(name), "=lambda:%" PRId32, l.lambda_id);
+
+        if ((status = luaL_loadbuffer(L, buffer, size, name)) != 0) {
             goto end;
         }
+        LCM_TRACE_PHASE(state, LCM_PHASE_LOAD, mark);
+
+        // Capture lambda, if enabled, before anything can make it fail.
+        if (state->capture.function != NULL
+            && (state->capture_status
+                   = lcm_capture_lambda(state->capture, &l))
+                != 0) {
+            state->capture.function = NULL;
+        }
         if ((status = lua_pcall(L, 0, 0, 0)) != 0) {
             goto end;
         }
+        LCM_TRACE_PHASE(state, LCM_PHASE_EXEC, mark);
     }
     // Ensure that the executed job actually called `lcm:job()` with a function
     // as argument.
@@ -91,8 +301,56 @@ LCM_API int lcm_register(lua_State* L, const lcm_Lambda l)
             goto end;
         }
     }
+    const int function = lua_gettop(L);
 
+    // Save lambda information.
+    {
+        luaL_getmetafield(L, bottom + 1, LCM_STATE_METAFIELD_INFOS);
+        lua_pushinteger(L, l.lambda_id);
+        lcm_LambdaInfo* info = lua_newuserdata(L, sizeof(lcm_LambdaInfo));
+        info->lambda_id = l.lambda_id;
+        info->flags = l.flags;
+        info->jit = (lcm_JitStats){.traces = 0 };
+        info->perf = (lcm_PerfStats){.calls = 0 };
+        lua_settable(L, -3);
+    }
+    // Apply JIT settings, if running on LuaJIT.
+    if (lcm_jit_available(L)) {
+        if (!state->jit_attached) {
+            lua_pushvalue(L, bottom + 1);
+            lua_pushcclosure(L, lcm_jitevent, 1);
+            lcm_jit_attach(L);
+            state->jit_attached = 1;
+        }
+        lcm_jit_mode(L, function, l.jit.mode);
+        if ((status = lcm_jit_opt(L, l.jit.opt, l.jit.hotloop)) != 0) {
+            goto end;
+        }
+    }
+    // Process warmup batches.
+    {
+        state->warmup = 1;
+        for (size_t r = 0; r < l.warmup.rounds && status == 0; ++r) {
+            for (size_t i = 0; i < l.warmup.count && status == 0; ++i) {
+                lcm_Batch b = l.warmup.batches[i];
+                b.lambda_id = l.lambda_id;
+                status = lcm_process(L, b,
+                    (lcm_ClosureBatch){
+                        .context = NULL,
+                        .function = lcm_discard,
+                    });
+            }
+        }
+        state->warmup = 0;
+        state->lambda_id = l.lambda_id;
+        state->batch_id = 0;
+        state->active = 1;
+    }
 end:
+    if (state != NULL) {
+        state->active = 0;
+    }
+    lcm_logflush(state);
     lua_settop(L, bottom);
     return status;
 }
@@ -101,9 +359,10 @@ LCM_API int lcm_process(lua_State* L, const lcm_Batch b, lcm_ClosureBatch c)
 {
     const int bottom = lua_gettop(L);
     int status = 0;
+    LCM_TRACE_MARK(mark);
 
-    // Get and setup LCM context object.
-    lcm_State* state;
+    // Get LCM context object.
+    lcm_State* state = NULL;
     {
         lua_getglobal(L, LCM_STATE_NAME);
         if (lua_type(L, -1) != LUA_TUSERDATA) {
@@ -111,34 +370,521 @@ LCM_API int lcm_process(lua_State* L, const lcm_Batch b, lcm_ClosureBatch c)
             goto end;
         }
         state = luaL_checkudata(L, -1, LCM_STATE_METATYPE);
-        state->lambda_id = b.lambda_id;
-        state->batch_id = b.batch_id;
+        LCM_TRACE_PHASE(state, LCM_PHASE_LOOKUP, mark);
     }
-    // Get job function.
+    lcm_processrun(L, state, bottom + 1, &b, &c, &status, 1);
+
+end:
+    lcm_logflush(state);
+    lua_settop(L, bottom);
+    return status;
+}
+
+LCM_API size_t lcm_processv(lua_State* L, const lcm_Batch* bs,
+    const lcm_ClosureBatch* cs, int* statuses, size_t count)
+{
+    const int bottom = lua_gettop(L);
+    size_t n = 0;
+    LCM_TRACE_MARK(mark);
+
+    // Get LCM context object.
+    lcm_State* state = NULL;
     {
-        luaL_getmetafield(L, -1, LCM_STATE_METAFIELD_LAMBDAS);
-        lua_pushinteger(L, b.lambda_id);
-        lua_gettable(L, -2);
-        if (lua_type(L, -1) != LUA_TFUNCTION) {
-            status = LCM_ERRNOLAMBDA;
+        lua_getglobal(L, LCM_STATE_NAME);
+        if (lua_type(L, -1) != LUA_TUSERDATA) {
+            for (size_t i = 0; statuses != NULL && i < count; ++i) {
+                statuses[i] = LCM_ERRINIT;
+            }
+            goto end;
+        }
+        state = luaL_checkudata(L, -1, LCM_STATE_METATYPE);
+        LCM_TRACE_PHASE(state, LCM_PHASE_LOOKUP, mark);
+    }
+    // Process runs of consecutive batches with the same lambda ID together.
+    for (size_t i = 0, j; i < count; i = j) {
+        for (j = i + 1; j < count && bs[j].lambda_id == bs[i].lambda_id; ++j) {
+        }
+        n += lcm_processrun(L, state, bottom + 1, &bs[i], &cs[i],
+            statuses != NULL ? &statuses[i] : NULL, j - i);
+    }
+
+end:
+    lcm_logflush(state);
+    lua_settop(L, bottom);
+    return n;
+}
+
+static size_t lcm_processrun(lua_State* L, lcm_State* state, int index,
+    const lcm_Batch* bs, const lcm_ClosureBatch* cs, int* statuses,
+    size_t count)
+{
+    const int bottom = lua_gettop(L);
+    LCM_TRACE_MARK(mark);
+
+    state->lambda_id = bs[0].lambda_id;
+    state->batch_id = bs[0].batch_id;
+
+    // Get job function and information, keeping both on the stack in case the
+    // lambda is registered again while its batches are being processed.
+    luaL_getmetafield(L, index, LCM_STATE_METAFIELD_LAMBDAS);
+    lua_pushinteger(L, bs[0].lambda_id);
+    lua_gettable(L, -2);
+    const int function = lua_gettop(L);
+    luaL_getmetafield(L, index, LCM_STATE_METAFIELD_INFOS);
+    lua_pushinteger(L, bs[0].lambda_id);
+    lua_gettable(L, -2);
+    lcm_LambdaInfo* info = lua_touserdata(L, -1);
+    LCM_TRACE_PHASE(state, LCM_PHASE_FETCH, mark);
+
+    size_t n = 0;
+    if (info != NULL && (info->flags & LCM_LAMBDA_FVECTOR) != 0
+        && lua_type(L, function) == LUA_TFUNCTION) {
+        n = lcm_processgroup(
+            L, state, index, function, info, bs, cs, statuses, count);
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            const int status = lcm_processone(
+                L, state, index, function, info, bs[i], cs[i]);
+            if (status == 0) {
+                n++;
+            }
+            if (statuses != NULL) {
+                statuses[i] = status;
+            }
+        }
+    }
+    lua_settop(L, bottom);
+    return n;
+}
+
+static int lcm_processone(lua_State* L, lcm_State* state, int index,
+    int function, lcm_LambdaInfo* info, const lcm_Batch b, lcm_ClosureBatch c)
+{
+    const int bottom = lua_gettop(L);
+    int status = 0;
+    LCM_TRACE_MARK(mark);
+
+    const int capture = state->capture.function != NULL && !state->warmup;
+    const uint64_t start = capture ? lcm_time_now() : 0;
+
+    state->lambda_id = b.lambda_id;
+    state->batch_id = b.batch_id;
+    state->active = 1;
+    state->depth++;
+
+    // Decode batch data, if encoded.
+    const uint8_t* bytes = b.data.bytes;
+    size_t length = b.data.length;
+    if (b.encoding != LCM_ENCODING_RAW) {
+        if (state->codecs == NULL) {
+            status = LCM_ERRCODEC;
+            goto end;
+        }
+        luaL_getmetafield(L, index, LCM_STATE_METAFIELD_SCRATCH);
+        status = lcm_codecs_decode(L, state->codecs, -1, b.encoding,
+            b.data.bytes, b.data.length, &bytes, &length);
+        lua_pop(L, 1);
+        if (status != 0) {
             goto end;
         }
+        LCM_TRACE_PHASE(state, LCM_PHASE_DECODE, mark);
+    }
+    // Look up cached result, if lambda is pure and caching is enabled.
+    int cache = 0;
+    uint64_t hash = 0;
+    if (state->cache != NULL && !state->warmup && info != NULL
+        && (info->flags & LCM_LAMBDA_FPURE) != 0) {
+        luaL_getmetafield(L, index, LCM_STATE_METAFIELD_CACHED);
+        cache = lua_gettop(L);
+        hash = lcm_cache_hash(bytes, length);
+        const int hit = lcm_cache_get(
+            L, state->cache, cache, b.lambda_id, hash, bytes, length);
+        LCM_TRACE_PHASE(state, LCM_PHASE_CACHE, mark);
+        if (hit) {
+            goto result;
+        }
+    }
+    if (lua_type(L, function) != LUA_TFUNCTION) {
+        status = LCM_ERRNOLAMBDA;
+        goto end;
     }
     // Call job function.
     {
-        lua_pushlstring(L, (char*)b.data.bytes, b.data.length);
-        if ((status = lua_pcall(L, 1, 1, 0)) != 0) {
+        lua_pushvalue(L, function);
+        lua_pushlstring(L, (const char*)bytes, length);
+        if (cache != 0) {
+            // Keep input string around for the cache.
+            lua_pushvalue(L, -1);
+            lua_insert(L, -3);
+        }
+        LCM_TRACE_PHASE(state, LCM_PHASE_PUSH, mark);
+        const int perf = state->perf != NULL && !state->warmup && info != NULL;
+        if (perf) {
+            lcm_perf_begin(state->perf);
+        }
+        status = lua_pcall(L, 1, 1, 0);
+        if (perf) {
+            lcm_perf_end(state->perf, &info->perf);
+        }
+        if (status != 0) {
             goto end;
         }
+        LCM_TRACE_PHASE(state, LCM_PHASE_PCALL, mark);
         if (lua_type(L, -1) != LUA_TSTRING) {
             status = LCM_ERRNORESULT;
             goto end;
         }
+        if (cache != 0) {
+            lcm_cache_put(
+                L, state->cache, cache, b.lambda_id, hash, -2, -1);
+        }
     }
     // Handle job results.
-    lcm_Batch r = {.lambda_id = b.lambda_id, .batch_id = b.batch_id };
+result:;
+    lcm_Batch r = {
+        .lambda_id = b.lambda_id,
+        .batch_id = b.batch_id,
+        .encoding = b.encoding,
+    };
     r.data.bytes = (uint8_t*)lua_tolstring(L, -1, &r.data.length);
+    if (b.encoding != LCM_ENCODING_RAW) {
+        // Results of nested calls, made by result closures still using the
+        // scratch buffer, are encoded into buffers of their own.
+        int scratch = 0;
+        if (state->depth == 1) {
+            luaL_getmetafield(L, index, LCM_STATE_METAFIELD_SCRATCH);
+            scratch = -1;
+        }
+        const uint8_t* encoded;
+        status = lcm_codecs_encode(L, state->codecs, scratch, b.encoding,
+            r.data.bytes, r.data.length, &encoded, &r.data.length);
+        if (status != 0) {
+            goto end;
+        }
+        r.data.bytes = (uint8_t*)encoded;
+    }
+    LCM_TRACE_PHASE(state, LCM_PHASE_RESULT, mark);
     c.function(c.context, &r);
+    LCM_TRACE_PHASE(state, LCM_PHASE_CALLBACK, mark);
+
+end:
+    if (capture) {
+        const uint64_t duration = lcm_time_now() - start;
+        state->capture_status
+            = lcm_capture_batch(state->capture, &b, status, start, duration);
+        if (state->capture_status != 0) {
+            state->capture.function = NULL;
+        }
+    }
+    state->active = 0;
+    state->depth--;
+    lua_settop(L, bottom);
+    return status;
+}
+
+static size_t lcm_processgroup(lua_State* L, lcm_State* state, int index,
+    int function, lcm_LambdaInfo* info, const lcm_Batch* bs,
+    const lcm_ClosureBatch* cs, int* statuses, size_t count)
+{
+    const int bottom = lua_gettop(L);
+    LCM_TRACE_MARK(mark);
+
+    const int capture = state->capture.function != NULL && !state->warmup;
+    const uint64_t start = capture ? lcm_time_now() : 0;
+
+    state->lambda_id = bs[0].lambda_id;
+    state->batch_id = bs[0].batch_id;
+    state->active = 1;
+    state->depth++;
+
+    lcm_GroupEntry* entries
+        = lua_newuserdata(L, count * sizeof(lcm_GroupEntry));
+    lua_createtable(L, (int)count, 0);
+    const int inputs = lua_gettop(L);
+
+    // Prepare for looking up cached results, if lambda is pure and caching is
+    // enabled, keeping any results found in a table of their own.
+    int cache = 0, hits = 0;
+    if (state->cache != NULL && !state->warmup
+        && (info->flags & LCM_LAMBDA_FPURE) != 0) {
+        luaL_getmetafield(L, index, LCM_STATE_METAFIELD_CACHED);
+        cache = lua_gettop(L);
+        lua_newtable(L);
+        hits = lua_gettop(L);
+    }
+    // Decode batches and look up cached results, collecting the data of all
+    // batches without results as lambda inputs.
+    int calls = 0;
+    for (size_t k = 0; k < count; ++k) {
+        const lcm_Batch* b = &bs[k];
+        entries[k] = (lcm_GroupEntry){.status = 0, .input = 0 };
+
+        const uint8_t* bytes = b->data.bytes;
+        size_t length = b->data.length;
+        if (b->encoding != LCM_ENCODING_RAW) {
+            int status = LCM_ERRCODEC;
+            if (state->codecs != NULL) {
+                luaL_getmetafield(L, index, LCM_STATE_METAFIELD_SCRATCH);
+                status = lcm_codecs_decode(L, state->codecs, -1, b->encoding,
+                    b->data.bytes, b->data.length, &bytes, &length);
+                lua_pop(L, 1);
+            }
+            if (status != 0) {
+                entries[k].status = status;
+                continue;
+            }
+        }
+        if (cache != 0) {
+            const uint64_t hash = lcm_cache_hash(bytes, length);
+            if (lcm_cache_get(L, state->cache, cache, b->lambda_id, hash,
+                    bytes, length)) {
+                lua_rawseti(L, hits, (int)k + 1);
+                continue;
+            }
+        }
+        lua_pushlstring(L, (const char*)bytes, length);
+        lua_rawseti(L, inputs, ++calls);
+        entries[k].input = calls;
+    }
+    LCM_TRACE_PHASE(state, LCM_PHASE_PUSH, mark);
+
+    // Call job function once with all inputs, expecting a table of results.
+    int outputs = 0;
+    if (calls > 0) {
+        lua_pushvalue(L, function);
+        lua_pushvalue(L, inputs);
+        const int perf = state->perf != NULL && !state->warmup;
+        if (perf) {
+            lcm_perf_begin(state->perf);
+        }
+        int status = lua_pcall(L, 1, 1, 0);
+        if (perf) {
+            lcm_perf_end(state->perf, &info->perf);
+        }
+        LCM_TRACE_PHASE(state, LCM_PHASE_PCALL, mark);
+        if (status == 0 && lua_type(L, -1) != LUA_TTABLE) {
+            status = LCM_ERRNORESULT;
+        }
+        if (status == 0) {
+            outputs = lua_gettop(L);
+        }
+        for (size_t k = 0; k < count && status != 0; ++k) {
+            if (entries[k].input > 0) {
+                entries[k].status = status;
+            }
+        }
+    }
+    // Save results to cache, encode them and provide them to their closures.
+    size_t n = 0;
+    const int top = lua_gettop(L);
+    for (size_t k = 0; k < count; ++k) {
+        const lcm_Batch* b = &bs[k];
+        lcm_GroupEntry* e = &entries[k];
+        state->batch_id = b->batch_id;
+
+        if (e->status == 0 && e->input > 0) {
+            lua_rawgeti(L, outputs, e->input);
+            if (lua_type(L, -1) != LUA_TSTRING) {
+                e->status = LCM_ERRNORESULT;
+            } else if (cache != 0) {
+                size_t length;
+                lua_rawgeti(L, inputs, e->input);
+                const char* input = lua_tolstring(L, -1, &length);
+                lcm_cache_put(L, state->cache, cache, b->lambda_id,
+                    lcm_cache_hash((const uint8_t*)input, length), -1, -2);
+                lua_pop(L, 1);
+            }
+        } else if (e->status == 0) {
+            lua_rawgeti(L, hits, (int)k + 1);
+        }
+        if (e->status == 0) {
+            lcm_Batch r = {
+                .lambda_id = b->lambda_id,
+                .batch_id = b->batch_id,
+                .encoding = b->encoding,
+            };
+            r.data.bytes = (uint8_t*)lua_tolstring(L, -1, &r.data.length);
+            if (b->encoding != LCM_ENCODING_RAW) {
+                int scratch = 0;
+                if (state->depth == 1) {
+                    luaL_getmetafield(L, index, LCM_STATE_METAFIELD_SCRATCH);
+                    scratch = -1;
+                }
+                const uint8_t* encoded;
+                e->status = lcm_codecs_encode(L, state->codecs, scratch,
+                    b->encoding, r.data.bytes, r.data.length, &encoded,
+                    &r.data.length);
+                r.data.bytes = (uint8_t*)encoded;
+            }
+            if (e->status == 0) {
+                LCM_TRACE_PHASE(state, LCM_PHASE_RESULT, mark);
+                cs[k].function(cs[k].context, &r);
+                LCM_TRACE_PHASE(state, LCM_PHASE_CALLBACK, mark);
+                n++;
+            }
+        }
+        if (statuses != NULL) {
+            statuses[k] = e->status;
+        }
+        lua_settop(L, top);
+    }
+    // Capture batches, dividing the time spent evenly among them.
+    if (capture) {
+        const uint64_t duration = (lcm_time_now() - start) / count;
+        for (size_t k = 0; k < count && state->capture.function != NULL;
+             ++k) {
+            state->capture_status = lcm_capture_batch(
+                state->capture, &bs[k], entries[k].status, start, duration);
+            if (state->capture_status != 0) {
+                state->capture.function = NULL;
+            }
+        }
+    }
+    state->active = 0;
+    state->depth--;
+    lua_settop(L, bottom);
+    return n;
+}
+
+LCM_API int lcm_capturestatus(lua_State* L)
+{
+    lua_getglobal(L, LCM_STATE_NAME);
+    if (lua_type(L, -1) != LUA_TUSERDATA) {
+        lua_pop(L, 1);
+        return LCM_ERRINIT;
+    }
+    const lcm_State* state = luaL_checkudata(L, -1, LCM_STATE_METATYPE);
+    const int status = state->capture_status;
+    lua_pop(L, 1);
+    return status;
+}
+
+LCM_API int lcm_cachestats(lua_State* L, lcm_CacheStats* s)
+{
+    lua_getglobal(L, LCM_STATE_NAME);
+    if (lua_type(L, -1) != LUA_TUSERDATA) {
+        lua_pop(L, 1);
+        return LCM_ERRINIT;
+    }
+    const lcm_State* state = luaL_checkudata(L, -1, LCM_STATE_METATYPE);
+    *s = state->cache != NULL ? state->cache->stats
+                              : (lcm_CacheStats){.entries = 0 };
+    lua_pop(L, 1);
+    return 0;
+}
+
+LCM_API int lcm_jitstats(lua_State* L, int32_t lambda_id, lcm_JitStats* s)
+{
+    lua_getglobal(L, LCM_STATE_NAME);
+    if (lua_type(L, -1) != LUA_TUSERDATA) {
+        lua_pop(L, 1);
+        return LCM_ERRINIT;
+    }
+    const lcm_LambdaInfo* info = lcm_lambdainfo(L, -1, lambda_id);
+    lua_pop(L, 1);
+    if (info == NULL) {
+        return LCM_ERRNOLAMBDA;
+    }
+    *s = info->jit;
+    return 0;
+}
+
+LCM_API int lcm_perfstats(lua_State* L, int32_t lambda_id, lcm_PerfStats* s)
+{
+    lua_getglobal(L, LCM_STATE_NAME);
+    if (lua_type(L, -1) != LUA_TUSERDATA) {
+        lua_pop(L, 1);
+        return LCM_ERRINIT;
+    }
+    const lcm_State* state = luaL_checkudata(L, -1, LCM_STATE_METATYPE);
+    const lcm_LambdaInfo* info = lcm_lambdainfo(L, -1, lambda_id);
+    lua_pop(L, 1);
+    if (state->perf == NULL) {
+        return LCM_ERRNOPERF;
+    }
+    if (info == NULL) {
+        return LCM_ERRNOLAMBDA;
+    }
+    *s = info->perf;
+    s->available = state->perf->available;
+    return 0;
+}
+
+LCM_API int lcm_trace(lua_State* L, lcm_ClosureWrite w)
+{
+#ifdef LCM_USE_TRACE
+    lua_getglobal(L, LCM_STATE_NAME);
+    if (lua_type(L, -1) != LUA_TUSERDATA) {
+        lua_pop(L, 1);
+        return LCM_ERRINIT;
+    }
+    const lcm_State* state = luaL_checkudata(L, -1, LCM_STATE_METATYPE);
+    lua_pop(L, 1);
+    return lcm_trace_write(state->trace, w);
+#else
+    (void)L;
+    (void)w;
+    return LCM_ERRNOSUPPORT;
+#endif
+}
+
+LCM_API int lcm_profstart(lua_State* L, int interval)
+{
+    lua_getglobal(L, LCM_STATE_NAME);
+    if (lua_type(L, -1) != LUA_TUSERDATA) {
+        lua_pop(L, 1);
+        return LCM_ERRINIT;
+    }
+    const lcm_State* state = luaL_checkudata(L, -1, LCM_STATE_METATYPE);
+    lua_pop(L, 1);
+    lcm_profile_start(L, &state->lambda_id, &state->active, interval);
+    return 0;
+}
+
+LCM_API int lcm_profstop(lua_State* L, lcm_ClosureWrite w)
+{
+    lua_getglobal(L, LCM_STATE_NAME);
+    if (lua_type(L, -1) != LUA_TUSERDATA) {
+        lua_pop(L, 1);
+        return LCM_ERRINIT;
+    }
+    lua_pop(L, 1);
+    return lcm_profile_stop(L, w);
+}
+
+LCM_API int lcm_checkpoint(lua_State* L, lcm_ClosureWrite w, int flags)
+{
+    const int bottom = lua_gettop(L);
+    int status = 0;
+
+    lua_getglobal(L, LCM_STATE_NAME);
+    if (lua_type(L, -1) != LUA_TUSERDATA) {
+        status = LCM_ERRINIT;
+        goto end;
+    }
+    luaL_getmetafield(L, bottom + 1, LCM_STATE_METAFIELD_STATES);
+    luaL_getmetafield(L, bottom + 1, LCM_STATE_METAFIELD_SHADOWS);
+    status = lcm_state_checkpoint(
+        L, -2, -1, w, (flags & LCM_CHECKPOINT_FDELTA) != 0);
+
+end:
+    lua_settop(L, bottom);
+    return status;
+}
+
+LCM_API int lcm_restore(lua_State* L, lcm_ClosureRead r)
+{
+    const int bottom = lua_gettop(L);
+    int status = 0;
+
+    lua_getglobal(L, LCM_STATE_NAME);
+    if (lua_type(L, -1) != LUA_TUSERDATA) {
+        status = LCM_ERRINIT;
+        goto end;
+    }
+    luaL_getmetafield(L, bottom + 1, LCM_STATE_METAFIELD_STATES);
+    luaL_getmetafield(L, bottom + 1, LCM_STATE_METAFIELD_SHADOWS);
+    status = lcm_state_restore(L, -2, -1, r);
 
 end:
     lua_settop(L, bottom);
@@ -164,6 +910,22 @@ LCM_API const char* lcm_errstr(const int err)
         return "LCM: Required lambda not available.";
     case LCM_ERRNORESULT:
         return "LCM: No result produced.";
+    case LCM_ERRNOSUPPORT:
+        return "LCM: Feature not compiled in.";
+    case LCM_ERRIO:
+        return "LCM: Read or write closure failed.";
+    case LCM_ERREXPIRED:
+        return "LCM: Batch deadline expired.";
+    case LCM_ERRFULL:
+        return "LCM: Queue full.";
+    case LCM_ERRCODEC:
+        return "LCM: Batch encoding or decoding failed.";
+    case LCM_ERRCRASH:
+        return "LCM: Worker process crashed.";
+    case LCM_ERRSTATE:
+        return "LCM: Lambda state not serializable.";
+    case LCM_ERRNOPERF:
+        return "LCM: Performance counters unavailable.";
     default:
         return "LCM: ?";
     }
@@ -192,19 +954,120 @@ int lcm_l_register(lua_State* L)
 
 int lcm_l_log(lua_State* L)
 {
-    const lcm_State* state = luaL_checkudata(L, 1, LCM_STATE_METATYPE);
+    lcm_State* state = luaL_checkudata(L, 1, LCM_STATE_METATYPE);
+    luaL_argcheck(L, lua_type(L, 2) == LUA_TFUNCTION || lua_isstring(L, 2), 2,
+        "string or function expected");
+    const int level = (int)luaL_optinteger(L, 3, LCM_LOG_INFO);
+    if (level < state->log_level) {
+        return 0;
+    }
+    if (state->log_buffer == NULL && state->closure_log.function == NULL) {
+        return 0;
+    }
+    // Produce message lazily, if provided as function.
+    if (lua_type(L, 2) == LUA_TFUNCTION) {
+        lua_pushvalue(L, 2);
+        lua_call(L, 0, 1);
+        lua_replace(L, 2);
+    }
     size_t message_length;
     const char* message = luaL_checklstring(L, 2, &message_length);
 
+    LCM_TRACE_INSTANT(state, LCM_PHASE_LOG);
+
+    const lcm_LogEntry entry = {
+        .lambda_id = state->lambda_id,
+        .batch_id = state->batch_id,
+        .level = level,
+        .timestamp = lcm_time_now(),
+        .message = {.string = message, .length = message_length },
+    };
+    if (state->log_buffer != NULL) {
+        if (lcm_logbuffer_push(state->log_buffer, &entry)) {
+            return 0;
+        }
+        if (!state->log_defer) {
+            lcm_logflush(state);
+            if (lcm_logbuffer_push(state->log_buffer, &entry)) {
+                return 0;
+            }
+            // Entry is larger than the whole buffer. Deliver it by itself.
+            const lcm_ClosureLogBatch c = state->closure_log_batch;
+            c.function(c.context, &entry, 1, 0);
+            return 0;
+        }
+        state->log_buffer->dropped++;
+        return 0;
+    }
     const lcm_ClosureLog c = state->closure_log;
-    if (c.function != NULL) {
-        c.function(
-            c.context,
-            &(lcm_LogEntry){
-                .lambda_id = state->lambda_id,
-                .batch_id = state->batch_id,
-                .message = {.string = message, .length = message_length },
-            });
+    c.function(c.context, &entry);
+    return 0;
+}
+
+int lcm_l_state(lua_State* L)
+{
+    const lcm_State* state = luaL_checkudata(L, 1, LCM_STATE_METATYPE);
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    // Replace any state declared by a previous lambda with the same ID.
+    luaL_getmetafield(L, 1, LCM_STATE_METAFIELD_STATES);
+    lua_pushinteger(L, state->lambda_id);
+    lua_pushvalue(L, 2);
+    lua_rawset(L, -3);
+    luaL_getmetafield(L, 1, LCM_STATE_METAFIELD_SHADOWS);
+    lua_pushinteger(L, state->lambda_id);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    lua_pop(L, 2);
+
+    lua_pushvalue(L, 2);
+    return 1;
+}
+
+static lcm_LambdaInfo* lcm_lambdainfo(lua_State* L, int index, int32_t id)
+{
+    luaL_getmetafield(L, index, LCM_STATE_METAFIELD_INFOS);
+    lua_pushinteger(L, id);
+    lua_gettable(L, -2);
+    lcm_LambdaInfo* info = lua_touserdata(L, -1);
+    lua_pop(L, 2);
+    return info;
+}
+
+static void lcm_logflush(lcm_State* state)
+{
+    if (state != NULL && state->log_buffer != NULL) {
+        lcm_logbuffer_flush(state->log_buffer, state->closure_log_batch);
+    }
+}
+
+static int lcm_jitevent(lua_State* L)
+{
+    const lcm_State* state = lua_touserdata(L, lua_upvalueindex(1));
+    if (!state->active) {
+        return 0;
+    }
+    lcm_LambdaInfo* info
+        = lcm_lambdainfo(L, lua_upvalueindex(1), state->lambda_id);
+    if (info == NULL) {
+        return 0;
+    }
+    const char* what = lua_tostring(L, 1);
+    if (what == NULL) {
+        return 0;
+    }
+    if (strcmp(what, "stop") == 0) {
+        info->jit.traces++;
+    } else if (strcmp(what, "abort") == 0) {
+        info->jit.aborts++;
+    } else if (strcmp(what, "flush") == 0) {
+        info->jit.flushes++;
     }
     return 0;
 }
+
+static void lcm_discard(void* context, const lcm_Batch* result)
+{
+    (void)context;
+    (void)result;
+}
@@ -16,7 +16,11 @@
 typedef struct lcm_Config lcm_Config;
 typedef struct lcm_Lambda lcm_Lambda;
 typedef struct lcm_Batch lcm_Batch;
+typedef struct lcm_Codec lcm_Codec;
 typedef struct lcm_LogEntry lcm_LogEntry;
+typedef struct lcm_CacheStats lcm_CacheStats;
+typedef struct lcm_JitStats lcm_JitStats;
+typedef struct lcm_PerfStats lcm_PerfStats;
 
 /**
  * Function used to receive `lcm:log()` calls.
@@ -26,6 +30,16 @@ typedef struct lcm_LogEntry lcm_LogEntry;
  */
 typedef void (*lcm_FunctionLog)(void* context, const lcm_LogEntry* entry);
 
+/**
+ * Function used to receive buffered `lcm:log()` calls in bulk.
+ *
+ * `dropped` is the number of entries discarded since the previous call, due to
+ * lack of buffer space. Provided `entries` are only guaranteed to point to
+ * valid memory during the invocation of the function.
+ */
+typedef void (*lcm_FunctionLogBatch)(void* context,
+    const lcm_LogEntry* entries, size_t count, uint64_t dropped);
+
 /**
  * Function used to receive batch processing results.
  *
@@ -34,6 +48,43 @@ typedef void (*lcm_FunctionLog)(void* context, const lcm_LogEntry* entry);
  */
 typedef void (*lcm_FunctionBatch)(void* context, const lcm_Batch* result);
 
+/**
+ * Function used to receive batches that could not be processed.
+ *
+ * Provided `batch` is only guaranteed to point to valid memory during the
+ * invocation of the function.
+ */
+typedef void (*lcm_FunctionFail)(
+    void* context, const lcm_Batch* batch, int status);
+
+/**
+ * Function used to receive output data.
+ *
+ * Must return `0` only if all of `data` was successfully consumed.
+ */
+typedef int (*lcm_FunctionWrite)(
+    void* context, const void* data, size_t length);
+
+/**
+ * Function used to provide input data.
+ *
+ * Is to write at most `length` bytes to `data`, and return the number of bytes
+ * written. Returning `0` signals that no more data is available, or that
+ * reading failed.
+ */
+typedef size_t (*lcm_FunctionRead)(void* context, void* data, size_t length);
+
+/**
+ * Function used to encode or decode batch data.
+ *
+ * Is to write the result of encoding or decoding `in` to `out`, unless
+ * `out_capacity` is too small, and return the length of the result, or
+ * `SIZE_MAX` if the operation failed. If the returned length exceeds
+ * `out_capacity`, the function is called again with a large enough `out`.
+ */
+typedef size_t (*lcm_FunctionCode)(void* context, const uint8_t* in,
+    size_t in_length, uint8_t* out, size_t out_capacity);
+
 /**
  * Closure holding some arbitrary context pointer and a function for
  * `lcm:log()` calls.
@@ -45,6 +96,17 @@ typedef struct lcm_ClosureLog {
     lcm_FunctionLog function;
 } lcm_ClosureLog;
 
+/**
+ * Closure holding some arbitrary context pointer and a function for buffered
+ * `lcm:log()` calls.
+ *
+ * When `function` is called, the `context` should be provided as argument.
+ */
+typedef struct lcm_ClosureLogBatch {
+    void* context;
+    lcm_FunctionLogBatch function;
+} lcm_ClosureLogBatch;
+
 /**
  * Closure holding some arbitrary context pointer and a function for receiving
  * batch processing results.
@@ -56,12 +118,101 @@ typedef struct lcm_ClosureBatch {
     lcm_FunctionBatch function;
 } lcm_ClosureBatch;
 
+/**
+ * Closure holding some arbitrary context pointer and a function for receiving
+ * batches that could not be processed.
+ *
+ * When `function` is called, the `context` should be provided as argument.
+ */
+typedef struct lcm_ClosureFail {
+    void* context;
+    lcm_FunctionFail function;
+} lcm_ClosureFail;
+
+/**
+ * Closure holding some arbitrary context pointer and a function for receiving
+ * output data.
+ *
+ * When `function` is called, the `context` should be provided as argument.
+ */
+typedef struct lcm_ClosureWrite {
+    void* context;
+    lcm_FunctionWrite function;
+} lcm_ClosureWrite;
+
+/**
+ * Closure holding some arbitrary context pointer and a function for providing
+ * input data.
+ *
+ * When `function` is called, the `context` should be provided as argument.
+ */
+typedef struct lcm_ClosureRead {
+    void* context;
+    lcm_FunctionRead function;
+} lcm_ClosureRead;
+
+/**
+ * Batch codec, such as a compression algorithm.
+ *
+ * `context` is provided as first argument to both functions, and may be used
+ * to hold state that can be reused between calls, such as compression
+ * dictionaries or buffers.
+ */
+struct lcm_Codec {
+    void* context;
+    lcm_FunctionCode decode;
+    lcm_FunctionCode encode;
+};
+
 /**
  * LCM Lua library configuration.
  */
 struct lcm_Config {
     /// Log closure used when forwarding `lcm:log()` calls. May be NULL.
     lcm_ClosureLog closure_log;
+
+    /// Lowest level of `lcm:log()` calls not to be ignored.
+    int log_level;
+
+    /// Log buffer settings.
+    struct {
+        /// Closure receiving buffered log entries. If not NULL, entries are
+        /// buffered and `closure_log` is never called.
+        lcm_ClosureLogBatch closure;
+
+        /// Log buffer size, in bytes, shared by entries and their messages.
+        /// Defaults to `LCM_LOG_BUFFER_SIZE`.
+        size_t size;
+
+        /// If not `0`, entries are only delivered when `lcm_register()` or
+        /// `lcm_process()` returns, and entries not fitting in the buffer are
+        /// dropped. Otherwise a full buffer is delivered immediately, and
+        /// entries larger than the whole buffer are delivered by themselves.
+        int defer;
+    } log_buffer;
+
+    /// Result cache settings.
+    struct {
+        /// Maximum number of cached results. `0` disables caching.
+        size_t capacity;
+    } cache;
+
+    /// Batch codecs. Batches with encoding `n` are decoded, and their results
+    /// encoded, using `codecs.list[n - 1]`. The list is copied.
+    struct {
+        const lcm_Codec* list;
+        size_t count;
+    } codecs;
+
+    /// Closure receiving capture records of all registered lambdas and
+    /// processed batches, as described in `lcmcapture.h`. May be NULL. If the
+    /// closure fails, capturing stops, which `lcm_capturestatus()` reports.
+    lcm_ClosureWrite capture;
+
+    /// If not `0`, hardware performance counters are read around every lambda
+    /// call, as described in `lcmperf.h`. Only supported on Linux, and only
+    /// counts the thread calling `lcm_openlib()`.
+    int perf;
 };
 
 /**
@@ -71,13 +222,47 @@ struct lcm_Config {
  * The lua program is required to call `lcm:register(lambda)` with a lambda
  * function. The registered function is subsequently called whenever a data
  * batch is processed with a matching lambda identifier.
+ *
+ * If `flags` contains `LCM_LAMBDA_FPURE`, the lambda is assumed to always
+ * produce the same result for the same batch data, which allows its results to
+ * be cached if caching is enabled in the `lcm_Config` of the Lua state.
+ *
+ * If `flags` contains `LCM_LAMBDA_FVECTOR`, the lambda function is called with
+ * an array of batch data strings rather than a single string, and is to return
+ * an array of result strings at the same indices. All consecutive batches of
+ * the lambda given to `lcm_processv()` are then passed to it in a single Lua
+ * call, while `lcm_process()` passes an array of one batch. Entries made by
+ * `lcm:log()` during such a call carry the ID of the first batch passed.
+ *
+ * When running on LuaJIT, `jit` may be used to control JIT compilation of the
+ * lambda, and `warmup` to have the lambda process sample batches before the
+ * registration completes, making it reach a compiled state before processing
+ * its first real batch. Note that `jit.opt` and `jit.hotloop` affect the whole
+ * Lua state, not only the lambda being registered.
  */
 struct lcm_Lambda {
     int32_t lambda_id;
+    uint32_t flags;
     struct {
         char* lua;
         size_t length;
     } program;
+    struct {
+        /// `LCM_JIT_DEFAULT`, `LCM_JIT_ON` or `LCM_JIT_OFF`.
+        int mode;
+        /// Space separated `jit.opt.start()` options, such as `"3"` or
+        /// `"maxtrace=2000 maxmcode=4096"`. May be NULL.
+        const char* opt;
+        /// Number of loop iterations before a loop is compiled, if positive.
+        int hotloop;
+    } jit;
+    struct {
+        /// Sample batches, each processed `rounds` times. Their results are
+        /// discarded and their lambda IDs ignored.
+        const lcm_Batch* batches;
+        size_t count;
+        size_t rounds;
+    } warmup;
 };
 
 /**
@@ -85,9 +270,14 @@ struct lcm_Lambda {
  *
  * Batches are fed as input into lambdas, and are also received as output when
  * lambdas complete.
+ *
+ * If `encoding` is not `LCM_ENCODING_RAW`, the data is decoded using the
+ * identified codec of the Lua state before being handed to the lambda, and
+ * lambda results are encoded using the same codec.
  */
 struct lcm_Batch {
     int32_t lambda_id, batch_id;
+    int32_t encoding;
     struct {
         uint8_t* bytes;
         size_t length;
@@ -97,20 +287,69 @@ struct lcm_Batch {
 /**
  * LCM log entry.
  *
- * Provided when receiving Lua `lcm:log()` calls.
+ * Provided when receiving Lua `lcm:log()` calls. `timestamp` is given in
+ * nanoseconds from some arbitrary point in time, and is only meaningful when
+ * compared to other timestamps.
  */
 struct lcm_LogEntry {
     int32_t lambda_id;
     int32_t batch_id;
+    int level;
+    uint64_t timestamp;
     struct {
         const char* string;
         size_t length;
     } message;
 };
 
+/**
+ * Result cache statistics.
+ *
+ * Hits and misses are only counted for lambdas flagged as pure.
+ */
+struct lcm_CacheStats {
+    uint64_t hits, misses, evictions;
+    size_t entries;
+};
+
+/**
+ * LuaJIT trace statistics of a lambda.
+ *
+ * `traces` counts successfully compiled traces and `aborts` trace compilations
+ * that were aborted, while the lambda was active. `flushes` counts flushes of
+ * all compiled code occurring while the lambda was active, which affect every
+ * lambda in the Lua state. Events occurring while no lambda is active, such as
+ * when running other Lua code between calls, are not counted.
+ */
+struct lcm_JitStats {
+    uint64_t traces, aborts, flushes;
+};
+
+/**
+ * Hardware performance counter totals of a lambda.
+ *
+ * `calls` counts measured calls of the lambda function, while `cycles`,
+ * `instructions`, `llc_misses` and `branch_misses` hold the CPU cycles,
+ * instructions, last level cache misses and branch misses counted during those
+ * calls. `unmeasured` counts calls during which the counters never ran, such
+ * as when other programs occupied them, which are left out of the totals.
+ *
+ * `available` holds the `LCM_PERF_F*` flags of the counters that could be
+ * opened. Counters not supported by the CPU, or not permitted by the kernel,
+ * have no flag set, and their totals remain zero.
+ */
+struct lcm_PerfStats {
+    uint64_t calls, cycles, instructions, llc_misses, branch_misses;
+    uint64_t unmeasured;
+    uint32_t available;
+};
+
 /**
  * Adds LCM library functions to provided lua state, with their behavior
  * customized using provided configuration, if given.
+ *
+ * If log buffering is enabled, buffered entries are delivered whenever
+ * `lcm_register()` or `lcm_process()` returns.
  */
 LCM_API void lcm_openlib(lua_State* L, const lcm_Config* c);
 
@@ -120,9 +359,14 @@ LCM_API void lcm_openlib(lua_State* L, const lcm_Config* c);
  * The provided lambda object is safe to destroy at any point after the
  * function returns.
  *
+ * Any results cached for a previously registered lambda with the same ID are
+ * discarded.
+ *
  * Returns `0` (OK), `LCM_ERRRUN`, `LCM_ERRSYNTAX`, `LCM_ERRMEM`, `LCM_ERRERR`,
  * `LCM_ERRINIT`, or `LCM_ERRNOCALL`. The last is returned only if the provided
- * lambda fails to call `lcm:lambda()` when evaluated.
+ * lambda fails to call `lcm:lambda()` when evaluated. If a warmup batch fails
+ * to be processed, the lambda remains registered and the `lcm_process()`
+ * error is returned.
  */
 LCM_API int lcm_register(lua_State* L, const lcm_Lambda l);
 
@@ -132,12 +376,152 @@ LCM_API int lcm_register(lua_State* L, const lcm_Lambda l);
  *
  * The batch provided to `c` is destroyed after the closure function returns.
  *
- * Returns `0` (OK), `LCM_ERRRUN`, `LCM_ERRMEM`, `LCM_ERRERR`, `LCM_ERRINIT` or
- * `LCM_ERRNORESULT`. The last is returned only if the lambda processing the
- * batch fails to return a batch result, in which case `c` is never called.
+ * If the lambda is flagged as pure and a result for identical batch data is
+ * cached, `c` is called with the cached result without invoking the lambda.
+ *
+ * Returns `0` (OK), `LCM_ERRRUN`, `LCM_ERRMEM`, `LCM_ERRERR`, `LCM_ERRINIT`,
+ * `LCM_ERRNOLAMBDA`, `LCM_ERRCODEC` or `LCM_ERRNORESULT`. The last is
+ * returned only if the lambda processing the batch fails to return a batch
+ * result, in which case `c` is never called.
  */
 LCM_API int lcm_process(lua_State* L, const lcm_Batch b, lcm_ClosureBatch c);
 
+/**
+ * Processes, using referenced Lua state, `count` batches in `bs`, providing
+ * the results of each batch to the function of the closure at the same index
+ * in `cs`.
+ *
+ * Produces the same results as calling `lcm_process()` once for each batch.
+ * The lookup of the LCM state object is shared by all batches, the lookups of
+ * lambda functions and information by all consecutive batches with the same
+ * lambda ID, and any buffered log entries are delivered only once, after the
+ * last batch has been processed. Consecutive batches of lambdas registered
+ * with `LCM_LAMBDA_FVECTOR` are passed to their lambda in a single Lua call,
+ * while other batches are passed to their lambdas in Lua calls of their own.
+ * Each batch is still decoded, looked up in the result cache, encoded and
+ * provided to its closure.
+ *
+ * If `statuses` is not NULL, the status code `lcm_process()` would have
+ * returned for each batch is written to it. Returns the number of batches
+ * successfully processed.
+ */
+LCM_API size_t lcm_processv(lua_State* L, const lcm_Batch* bs,
+    const lcm_ClosureBatch* cs, int* statuses, size_t count);
+
+/**
+ * Returns `LCM_ERRIO` if capturing stopped because the capture closure of
+ * referenced Lua state failed, `LCM_ERRINIT` if the Lua state has no LCM
+ * state, and `0` (OK) otherwise.
+ */
+LCM_API int lcm_capturestatus(lua_State* L);
+
+/**
+ * Copies result cache statistics of referenced Lua state into `s`.
+ *
+ * Returns `0` (OK) or `LCM_ERRINIT`. If caching is disabled, `s` is zeroed.
+ */
+LCM_API int lcm_cachestats(lua_State* L, lcm_CacheStats* s);
+
+/**
+ * Copies LuaJIT trace statistics of identified lambda into `s`.
+ *
+ * Statistics are reset whenever the lambda is registered, and are always zero
+ * if the Lua state does not run on LuaJIT.
+ *
+ * Returns `0` (OK), `LCM_ERRINIT` or `LCM_ERRNOLAMBDA`.
+ */
+LCM_API int lcm_jitstats(lua_State* L, int32_t lambda_id, lcm_JitStats* s);
+
+/**
+ * Copies hardware performance counter totals of identified lambda into `s`.
+ *
+ * Totals are reset whenever the lambda is registered. Warmup batches are not
+ * counted.
+ *
+ * Returns `0` (OK), `LCM_ERRINIT`, `LCM_ERRNOLAMBDA` or `LCM_ERRNOPERF`. The
+ * last is returned if counters were not enabled via `lcm_Config`, could not be
+ * opened, such as if not permitted by the kernel, or if not running on Linux.
+ */
+LCM_API int lcm_perfstats(
+    lua_State* L, int32_t lambda_id, lcm_PerfStats* s);
+
+/**
+ * Writes all phase timings recorded in referenced Lua state to closure `w`, in
+ * the Chrome trace event JSON format, and then discards them.
+ *
+ * The output can be opened using `chrome://tracing` or Perfetto. Only the
+ * latest `LCM_TRACE_CAPACITY` events are retained between calls. The number of
+ * older events discarded is written as `otherData.overwritten`, which is not
+ * zero if the trace is incomplete.
+ *
+ * Returns `0` (OK), `LCM_ERRINIT`, `LCM_ERRIO` or `LCM_ERRNOSUPPORT`. The last
+ * is returned if the library was compiled without `LCM_USE_TRACE`.
+ */
+LCM_API int lcm_trace(lua_State* L, lcm_ClosureWrite w);
+
+/**
+ * Starts sampling profiler in referenced Lua state.
+ *
+ * Samples are attributed to the lambda active when they are taken, as well as
+ * to the source lines of the sampled Lua call stack. The lines of each lambda
+ * program are reported as belonging to chunk `lambda:<lambda_id>`. Samples
+ * taken while no lambda is running, such as when Lua code is run between calls
+ * to `lcm_process()`, are attributed to `[outside]`.
+ *
+ * If the `jit.profile` module of LuaJIT 2.1 is available, it is used to take a
+ * sample every `interval` milliseconds. Otherwise a Lua count hook is used to
+ * take a sample every `interval` Lua VM instructions, replacing any other hook
+ * set on the state.
+ *
+ * Returns `0` (OK) or `LCM_ERRINIT`.
+ */
+LCM_API int lcm_profstart(lua_State* L, int interval);
+
+/**
+ * Stops sampling profiler in referenced Lua state, and writes collected
+ * samples to closure `w` in the collapsed stack format used by flame graph
+ * tools, such as `flamegraph.pl`.
+ *
+ * Returns `0` (OK), `LCM_ERRINIT` or `LCM_ERRIO`.
+ */
+LCM_API int lcm_profstop(lua_State* L, lcm_ClosureWrite w);
+
+/**
+ * Writes the state tables declared by the lambdas of referenced Lua state,
+ * using `lcm:state()`, to closure `w`, in a compact binary format. Only
+ * booleans, numbers, strings and tables thereof can be written.
+ *
+ * If `flags` contains `LCM_CHECKPOINT_FDELTA`, only the state table fields
+ * that changed since the previous checkpoint, at any depth, are written for
+ * lambdas that were part of it. To be able to tell what changed, a copy of
+ * every state table is kept from one checkpoint to the next, and updated with
+ * the changes written.
+ *
+ * Returns `0` (OK), `LCM_ERRINIT`, `LCM_ERRIO` or `LCM_ERRSTATE`. The last is
+ * returned if a state table contains values that cannot be written, tables
+ * nested deeper than `LCM_STATE_DEPTH`, or, when writing a delta, changes to
+ * fields whose paths include tables used as keys. If not OK, the next
+ * checkpoint is written as if `LCM_CHECKPOINT_FDELTA` was not given.
+ */
+LCM_API int lcm_checkpoint(lua_State* L, lcm_ClosureWrite w, int flags);
+
+/**
+ * Reads checkpoint written by `lcm_checkpoint()` from closure `r`, and updates
+ * the state tables of the lambdas of referenced Lua state accordingly. The
+ * lambdas must have been registered before their states can be restored. A
+ * full checkpoint is to be restored first, and then every delta checkpoint
+ * written after it, in order. State of lambdas not in the checkpoint is left
+ * untouched.
+ *
+ * No state is updated unless the whole checkpoint could be read. As `r` may be
+ * read past the end of the checkpoint, each checkpoint must be provided by a
+ * closure of its own.
+ *
+ * Returns `0` (OK), `LCM_ERRINIT`, `LCM_ERRIO` or `LCM_ERRSTATE`. The last is
+ * returned if the read data is not a valid checkpoint.
+ */
+LCM_API int lcm_restore(lua_State* L, lcm_ClosureRead r);
+
 /** Returns string representation of provided LCM error code. */
 LCM_API const char* lcm_errstr(const int err);
 
@@ -0,0 +1,136 @@
+#include "lcmcache.h"
+#include <string.h>
+
+// Converts relative stack index into an absolute one.
+#define ABSINDEX(L, i) ((i) > 0 ? (i) : lua_gettop(L) + (i) + 1)
+
+lcm_Cache* lcm_cache_new(lua_State* L, size_t capacity)
+{
+    // Round set count up to nearest power of two.
+    size_t sets = 1;
+    while (sets * LCM_CACHE_WAYS < capacity) {
+        sets <<= 1;
+    }
+    const size_t slots = sets * LCM_CACHE_WAYS;
+
+    lcm_Cache* cache = lua_newuserdata(
+        L, sizeof(lcm_Cache) + slots * sizeof(lcm_CacheSlot));
+    cache->sets = sets;
+    cache->tick = 0;
+    cache->stats = (lcm_CacheStats){.entries = 0 };
+    memset(cache->slots, 0, slots * sizeof(lcm_CacheSlot));
+
+    // Create table holding input and result strings of each slot.
+    lua_createtable(L, (int)(slots * 2), 0);
+
+    return cache;
+}
+
+uint64_t lcm_cache_hash(const uint8_t* bytes, size_t length)
+{
+    uint64_t h = UINT64_C(0x9E3779B97F4A7C15) ^ length;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        h = (h ^ word) * UINT64_C(0xFF51AFD7ED558CCD);
+        h ^= h >> 32;
+        bytes += 8;
+        length -= 8;
+    }
+    if (length > 0) {
+        uint64_t word = 0;
+        memcpy(&word, bytes, length);
+        h = (h ^ word) * UINT64_C(0xFF51AFD7ED558CCD);
+    }
+    h ^= h >> 33;
+    h *= UINT64_C(0xC4CEB9FE1A85EC53);
+    h ^= h >> 33;
+    return h;
+}
+
+int lcm_cache_get(lua_State* L, lcm_Cache* cache, int strings,
+    int32_t lambda_id, uint64_t hash, const uint8_t* bytes, size_t length)
+{
+    strings = ABSINDEX(L, strings);
+
+    const size_t first = (hash & (cache->sets - 1)) * LCM_CACHE_WAYS;
+    for (size_t i = first; i < first + LCM_CACHE_WAYS; ++i) {
+        lcm_CacheSlot* slot = &cache->slots[i];
+        if (!slot->used || slot->hash != hash || slot->lambda_id != lambda_id) {
+            continue;
+        }
+        // Rule out hash collisions by comparing against cached input.
+        size_t input_length;
+        lua_rawgeti(L, strings, (int)(i * 2 + 1));
+        const char* input = lua_tolstring(L, -1, &input_length);
+        const int match = input_length == length
+            && memcmp(input, bytes, length) == 0;
+        lua_pop(L, 1);
+        if (!match) {
+            continue;
+        }
+        slot->stamp = ++cache->tick;
+        cache->stats.hits++;
+        lua_rawgeti(L, strings, (int)(i * 2 + 2));
+        return 1;
+    }
+    cache->stats.misses++;
+    return 0;
+}
+
+void lcm_cache_put(lua_State* L, lcm_Cache* cache, int strings,
+    int32_t lambda_id, uint64_t hash, int input, int result)
+{
+    strings = ABSINDEX(L, strings);
+    input = ABSINDEX(L, input);
+    result = ABSINDEX(L, result);
+
+    // Pick first unused slot in set, or least recently used if none is free.
+    const size_t first = (hash & (cache->sets - 1)) * LCM_CACHE_WAYS;
+    size_t victim = first;
+    for (size_t i = first; i < first + LCM_CACHE_WAYS; ++i) {
+        if (!cache->slots[i].used) {
+            victim = i;
+            break;
+        }
+        if (cache->slots[i].stamp < cache->slots[victim].stamp) {
+            victim = i;
+        }
+    }
+    lcm_CacheSlot* slot = &cache->slots[victim];
+    if (slot->used) {
+        cache->stats.evictions++;
+    } else {
+        cache->stats.entries++;
+    }
+    slot->hash = hash;
+    slot->stamp = ++cache->tick;
+    slot->lambda_id = lambda_id;
+    slot->used = 1;
+
+    lua_pushvalue(L, input);
+    lua_rawseti(L, strings, (int)(victim * 2 + 1));
+    lua_pushvalue(L, result);
+    lua_rawseti(L, strings, (int)(victim * 2 + 2));
+}
+
+void lcm_cache_invalidate(
+    lua_State* L, lcm_Cache* cache, int strings, int32_t lambda_id)
+{
+    strings = ABSINDEX(L, strings);
+
+    const size_t slots = cache->sets * LCM_CACHE_WAYS;
+    for (size_t i = 0; i < slots; ++i) {
+        lcm_CacheSlot* slot = &cache->slots[i];
+        if (!slot->used || slot->lambda_id != lambda_id) {
+            continue;
+        }
+        slot->used = 0;
+        cache->stats.entries--;
+
+        lua_pushnil(L);
+        lua_rawseti(L, strings, (int)(i * 2 + 1));
+        lua_pushnil(L);
+        lua_rawseti(L, strings, (int)(i * 2 + 2));
+    }
+}
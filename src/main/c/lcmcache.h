@@ -0,0 +1,71 @@
+/**
+ * Lua/compute result cache header.
+ *
+ * The result cache is a set-associative table of batch results, keyed by
+ * lambda ID and a hash of batch input data. Each set holds `LCM_CACHE_WAYS`
+ * slots, and the least recently used slot of a set is evicted whenever a new
+ * result is inserted into a full set.
+ *
+ * Slot metadata is kept in a Lua userdata object, while the input and result
+ * strings of each slot are kept in a separate table, provided by the caller,
+ * at indices `slot * 2 + 1` and `slot * 2 + 2`. All memory used by the cache
+ * is consequently managed by the Lua garbage collector.
+ *
+ * @file
+ */
+#ifndef lcmcache_h
+#define lcmcache_h
+
+#include "lcm.h"
+
+/** Result cache slot. */
+typedef struct {
+    uint64_t hash;
+    uint64_t stamp;
+    int32_t lambda_id;
+    int used;
+} lcm_CacheSlot;
+
+/** Result cache. */
+typedef struct {
+    size_t sets;
+    uint64_t tick;
+    lcm_CacheStats stats;
+    lcm_CacheSlot slots[];
+} lcm_Cache;
+
+/**
+ * Creates cache able to hold at least `capacity` results and pushes it onto
+ * the stack of `L`, followed by the table holding its strings.
+ */
+lcm_Cache* lcm_cache_new(lua_State* L, size_t capacity);
+
+/** Calculates cache hash of provided bytes. */
+uint64_t lcm_cache_hash(const uint8_t* bytes, size_t length);
+
+/**
+ * Looks up result of processing `bytes` with identified lambda in `cache`,
+ * whose strings are held by the table at stack index `strings`.
+ *
+ * If a result is found it is pushed onto the stack and `1` is returned.
+ * Otherwise nothing is pushed and `0` is returned.
+ */
+int lcm_cache_get(lua_State* L, lcm_Cache* cache, int strings,
+    int32_t lambda_id, uint64_t hash, const uint8_t* bytes, size_t length);
+
+/**
+ * Saves result string at stack index `result`, produced by processing input
+ * string at stack index `input` with identified lambda, in `cache`, whose
+ * strings are held by the table at stack index `strings`.
+ */
+void lcm_cache_put(lua_State* L, lcm_Cache* cache, int strings,
+    int32_t lambda_id, uint64_t hash, int input, int result);
+
+/**
+ * Removes all results of identified lambda from `cache`, whose strings are
+ * held by the table at stack index `strings`.
+ */
+void lcm_cache_invalidate(
+    lua_State* L, lcm_Cache* cache, int strings, int32_t lambda_id);
+
+#endif
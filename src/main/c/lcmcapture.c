@@ -0,0 +1,235 @@
+#include "lcmcapture.h"
+#include <string.h>
+
+#define LCM_CAPTURE_LAMBDA_HEADER 33
+#define LCM_CAPTURE_WARMUP_HEADER 12
+#define LCM_CAPTURE_BATCH_HEADER 37
+
+static uint8_t* lcm_capture_put32(uint8_t* p, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i) {
+        *p++ = (uint8_t)(v >> (i * 8));
+    }
+    return p;
+}
+
+static uint8_t* lcm_capture_put64(uint8_t* p, uint64_t v)
+{
+    for (int i = 0; i < 8; ++i) {
+        *p++ = (uint8_t)(v >> (i * 8));
+    }
+    return p;
+}
+
+static uint32_t lcm_capture_get32(const uint8_t* p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) {
+        v |= (uint32_t)p[i] << (i * 8);
+    }
+    return v;
+}
+
+static uint64_t lcm_capture_get64(const uint8_t* p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+        v |= (uint64_t)p[i] << (i * 8);
+    }
+    return v;
+}
+
+// Writes header and then body of record.
+static int lcm_capture_write(lcm_ClosureWrite w, const uint8_t* header,
+    size_t header_length, const void* body, size_t body_length)
+{
+    if (w.function(w.context, header, header_length) != 0) {
+        return LCM_ERRIO;
+    }
+    if (body_length > 0 && w.function(w.context, body, body_length) != 0) {
+        return LCM_ERRIO;
+    }
+    return 0;
+}
+
+int lcm_capture_lambda(lcm_ClosureWrite w, const lcm_Lambda* l)
+{
+    const size_t opt_length = l->jit.opt != NULL ? strlen(l->jit.opt) + 1 : 0;
+    if (l->program.length > UINT32_MAX || opt_length > UINT32_MAX
+        || l->warmup.count > UINT32_MAX || l->warmup.rounds > UINT32_MAX) {
+        return LCM_ERRIO;
+    }
+    for (size_t i = 0; i < l->warmup.count; ++i) {
+        if (l->warmup.batches[i].data.length > UINT32_MAX) {
+            return LCM_ERRIO;
+        }
+    }
+    uint8_t header[LCM_CAPTURE_LAMBDA_HEADER];
+    uint8_t* p = header;
+    *p++ = LCM_CAPTURE_LAMBDA;
+    p = lcm_capture_put32(p, (uint32_t)l->lambda_id);
+    p = lcm_capture_put32(p, l->flags);
+    p = lcm_capture_put32(p, (uint32_t)l->jit.mode);
+    p = lcm_capture_put32(p, (uint32_t)l->jit.hotloop);
+    p = lcm_capture_put32(p, (uint32_t)opt_length);
+    p = lcm_capture_put32(p, (uint32_t)l->warmup.count);
+    p = lcm_capture_put32(p, (uint32_t)l->warmup.rounds);
+    p = lcm_capture_put32(p, (uint32_t)l->program.length);
+    if (lcm_capture_write(
+            w, header, sizeof(header), l->program.lua, l->program.length)
+            != 0
+        || (opt_length > 0
+            && w.function(w.context, l->jit.opt, opt_length) != 0)) {
+        return LCM_ERRIO;
+    }
+    for (size_t i = 0; i < l->warmup.count; ++i) {
+        const lcm_Batch* b = &l->warmup.batches[i];
+        uint8_t warmup[LCM_CAPTURE_WARMUP_HEADER];
+        p = warmup;
+        p = lcm_capture_put32(p, (uint32_t)b->batch_id);
+        p = lcm_capture_put32(p, (uint32_t)b->encoding);
+        p = lcm_capture_put32(p, (uint32_t)b->data.length);
+        if (lcm_capture_write(
+                w, warmup, sizeof(warmup), b->data.bytes, b->data.length)
+            != 0) {
+            return LCM_ERRIO;
+        }
+    }
+    return 0;
+}
+
+int lcm_capture_batch(lcm_ClosureWrite w, const lcm_Batch* b, int status,
+    uint64_t timestamp, uint64_t duration)
+{
+    if (b->data.length > UINT32_MAX) {
+        return LCM_ERRIO;
+    }
+    uint8_t header[LCM_CAPTURE_BATCH_HEADER];
+    uint8_t* p = header;
+    *p++ = LCM_CAPTURE_BATCH;
+    p = lcm_capture_put32(p, (uint32_t)b->lambda_id);
+    p = lcm_capture_put32(p, (uint32_t)b->batch_id);
+    p = lcm_capture_put32(p, (uint32_t)b->encoding);
+    p = lcm_capture_put32(p, (uint32_t)status);
+    p = lcm_capture_put64(p, timestamp);
+    p = lcm_capture_put64(p, duration);
+    p = lcm_capture_put32(p, (uint32_t)b->data.length);
+    return lcm_capture_write(
+        w, header, sizeof(header), b->data.bytes, b->data.length);
+}
+
+LCM_API size_t lcm_capture_parse(
+    const uint8_t* data, size_t length, lcm_CaptureRecord* r)
+{
+    if (length == 0) {
+        return 0;
+    }
+    size_t header_length, body_length;
+    switch (data[0]) {
+    case LCM_CAPTURE_LAMBDA: {
+        if (length < LCM_CAPTURE_LAMBDA_HEADER) {
+            return 0;
+        }
+        header_length = LCM_CAPTURE_LAMBDA_HEADER;
+        const size_t opt_length = lcm_capture_get32(&data[17]);
+        const size_t count = lcm_capture_get32(&data[21]);
+        const size_t program_length = lcm_capture_get32(&data[29]);
+
+        // Walk program, options and warmup batches to find end of record.
+        const size_t available = length - header_length;
+        body_length = program_length;
+        if (body_length > available || opt_length > available - body_length) {
+            return 0;
+        }
+        body_length += opt_length;
+        const uint8_t* opt = &data[header_length + program_length];
+        if (opt_length > 0 && opt[opt_length - 1] != '\0') {
+            return 0;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (LCM_CAPTURE_WARMUP_HEADER > available - body_length) {
+                return 0;
+            }
+            const size_t n
+                = lcm_capture_get32(&data[header_length + body_length + 8]);
+            body_length += LCM_CAPTURE_WARMUP_HEADER;
+            if (n > available - body_length) {
+                return 0;
+            }
+            body_length += n;
+        }
+        *r = (lcm_CaptureRecord){
+            .type = LCM_CAPTURE_LAMBDA,
+            .lambda = {
+                .lambda_id = (int32_t)lcm_capture_get32(&data[1]),
+                .flags = lcm_capture_get32(&data[5]),
+                .program = {
+                    .lua = (char*)&data[header_length],
+                    .length = program_length,
+                },
+                .jit = {
+                    .mode = (int)(int32_t)lcm_capture_get32(&data[9]),
+                    .opt = opt_length > 0 ? (const char*)opt : NULL,
+                    .hotloop = (int)(int32_t)lcm_capture_get32(&data[13]),
+                },
+                .warmup = {
+                    .batches = NULL,
+                    .count = count,
+                    .rounds = lcm_capture_get32(&data[25]),
+                },
+            },
+            .warmup = opt + opt_length,
+        };
+        break;
+    }
+
+    case LCM_CAPTURE_BATCH:
+        if (length < LCM_CAPTURE_BATCH_HEADER) {
+            return 0;
+        }
+        header_length = LCM_CAPTURE_BATCH_HEADER;
+        body_length = lcm_capture_get32(&data[33]);
+        if (body_length > length - header_length) {
+            return 0;
+        }
+        *r = (lcm_CaptureRecord){
+            .type = LCM_CAPTURE_BATCH,
+            .batch = {
+                .lambda_id = (int32_t)lcm_capture_get32(&data[1]),
+                .batch_id = (int32_t)lcm_capture_get32(&data[5]),
+                .encoding = (int32_t)lcm_capture_get32(&data[9]),
+                .data = {
+                    .bytes = (uint8_t*)&data[header_length],
+                    .length = body_length,
+                },
+            },
+            .status = (int)(int32_t)lcm_capture_get32(&data[13]),
+            .timestamp = lcm_capture_get64(&data[17]),
+            .duration = lcm_capture_get64(&data[25]),
+        };
+        break;
+
+    default:
+        return 0;
+    }
+    return header_length + body_length;
+}
+
+LCM_API void lcm_capture_warmup(lcm_CaptureRecord* r, lcm_Batch* batches)
+{
+    const uint8_t* p = r->warmup;
+    for (size_t i = 0; i < r->lambda.warmup.count; ++i) {
+        const size_t length = lcm_capture_get32(&p[8]);
+        batches[i] = (lcm_Batch){
+            .lambda_id = r->lambda.lambda_id,
+            .batch_id = (int32_t)lcm_capture_get32(&p[0]),
+            .encoding = (int32_t)lcm_capture_get32(&p[4]),
+            .data = {
+                .bytes = (uint8_t*)&p[LCM_CAPTURE_WARMUP_HEADER],
+                .length = length,
+            },
+        };
+        p += LCM_CAPTURE_WARMUP_HEADER + length;
+    }
+    r->lambda.warmup.batches = batches;
+}
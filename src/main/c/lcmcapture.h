@@ -0,0 +1,102 @@
+/**
+ * Lua/compute batch capture header.
+ *
+ * If a capture closure is set in the `lcm_Config` of a Lua state, every
+ * registered lambda program and every processed batch is written to it as a
+ * capture record. Records are written in the order their lambdas were
+ * registered and batches processed, and can be appended to a file and later
+ * be parsed using `lcm_capture_parse()`, such as by the `lcmreplay` tool.
+ *
+ * All integers are encoded in little-endian byte order. Lambda records have
+ * the layout
+ *
+ *     u8 'L', i32 lambda_id, u32 flags, i32 jit_mode, i32 jit_hotloop,
+ *     u32 opt_length, u32 warmup_count, u32 warmup_rounds, u32 length,
+ *     u8 program[length], u8 opt[opt_length], warmup[warmup_count]
+ *
+ * where `opt` is the NUL-terminated `jit.opt` string of the lambda, or empty
+ * if NULL, and each warmup batch has the layout
+ *
+ *     i32 batch_id, i32 encoding, u32 length, u8 data[length]
+ *
+ * Lambda records are written as soon as their programs have been loaded, before
+ * they are executed, making lambdas failing to register captured as well.
+ * Batch records have the layout
+ *
+ *     u8 'B', i32 lambda_id, i32 batch_id, i32 encoding, i32 status,
+ *     u64 timestamp, u64 duration, u32 length, u8 data[length]
+ *
+ * where `timestamp` is the time the batch was submitted for processing,
+ * `duration` the number of nanoseconds spent processing it, `status` the
+ * resulting status code, and `data` the batch data as submitted, before any
+ * decoding. Warmup batches are not captured.
+ *
+ * As batch data is captured before being decoded, replaying a batch whose
+ * `encoding` is not `LCM_ENCODING_RAW` requires the codec it was decoded with
+ * to be set again. The `lcmreplay` tool sets no codecs, and refuses to replay
+ * captures containing such batches.
+ *
+ * @file
+ */
+#ifndef lcmcapture_h
+#define lcmcapture_h
+
+#include "lcm.h"
+
+#define LCM_CAPTURE_LAMBDA 'L'
+#define LCM_CAPTURE_BATCH 'B'
+
+/** Parsed capture record. */
+typedef struct {
+    /// `LCM_CAPTURE_LAMBDA` or `LCM_CAPTURE_BATCH`.
+    int type;
+
+    /// Captured lambda, if a lambda record. Its program and JIT options refer
+    /// to the parsed data. Its warmup batches are only set by
+    /// `lcm_capture_warmup()`.
+    lcm_Lambda lambda;
+
+    /// Warmup batches of lambda record, as parsed by `lcm_capture_warmup()`.
+    const uint8_t* warmup;
+
+    /// Captured batch, if a batch record. Its data refers to the parsed data.
+    lcm_Batch batch;
+    int status;
+    uint64_t timestamp;
+    uint64_t duration;
+} lcm_CaptureRecord;
+
+/**
+ * Writes lambda record describing `l` to `w`.
+ *
+ * Returns `0` (OK) or `LCM_ERRIO`.
+ */
+int lcm_capture_lambda(lcm_ClosureWrite w, const lcm_Lambda* l);
+
+/**
+ * Writes batch record describing `b` to `w`.
+ *
+ * Returns `0` (OK) or `LCM_ERRIO`.
+ */
+int lcm_capture_batch(lcm_ClosureWrite w, const lcm_Batch* b, int status,
+    uint64_t timestamp, uint64_t duration);
+
+/**
+ * Parses the capture record at the beginning of `data` into `r`.
+ *
+ * Returns the length of the parsed record, or `0` if `data` is too short to
+ * contain a complete record or does not begin with a known record type. A
+ * capture interrupted while being written typically ends with an incomplete
+ * record, which can be ignored.
+ */
+LCM_API size_t lcm_capture_parse(
+    const uint8_t* data, size_t length, lcm_CaptureRecord* r);
+
+/**
+ * Parses the warmup batches of lambda record `r` into `batches`, which must
+ * have room for `r->lambda.warmup.count` batches, and makes the lambda of `r`
+ * refer to them.
+ */
+LCM_API void lcm_capture_warmup(lcm_CaptureRecord* r, lcm_Batch* batches);
+
+#endif
@@ -0,0 +1,263 @@
+#include "lcmcoalesce.h"
+#include "lcmtime.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Batches waiting to be processed by the same lambda. */
+typedef struct {
+    int32_t lambda_id;
+    lcm_Batch* batches;
+    lcm_ClosureBatch* closures;
+    size_t count;
+    size_t target;
+    uint64_t oldest;
+    uint64_t estimate;
+    double cost;
+} lcm_CoalesceGroup;
+
+/**
+ * Batches taken out of a group to be processed. Runs not in use are kept in a
+ * list, which holds more than one run only if closures submitted batches that
+ * caused other groups to be processed.
+ */
+typedef struct lcm_CoalesceRun {
+    struct lcm_CoalesceRun* next;
+    lcm_Batch* batches;
+    lcm_ClosureBatch* closures;
+    int* statuses;
+} lcm_CoalesceRun;
+
+struct lcm_Coalescer {
+    lua_State* L;
+    size_t max_group;
+    uint64_t budget;
+    lcm_ClosureFail closure_fail;
+    lcm_CoalesceGroup* groups;
+    size_t groups_count, groups_capacity;
+    lcm_CoalesceRun* runs;
+};
+
+// Allocates run able to hold `max_group` batches.
+static lcm_CoalesceRun* lcm_coalesce_run(size_t max_group)
+{
+    lcm_CoalesceRun* run = malloc(sizeof(lcm_CoalesceRun)
+        + max_group
+            * (sizeof(lcm_Batch) + sizeof(lcm_ClosureBatch) + sizeof(int)));
+    if (run == NULL) {
+        return NULL;
+    }
+    run->next = NULL;
+    run->batches = (lcm_Batch*)(run + 1);
+    run->closures = (lcm_ClosureBatch*)(run->batches + max_group);
+    run->statuses = (int*)(run->closures + max_group);
+    return run;
+}
+
+LCM_API lcm_Coalescer* lcm_coalesce_new(
+    lua_State* L, size_t max_group, uint64_t budget, lcm_ClosureFail f)
+{
+    if (max_group == 0) {
+        max_group = 1;
+    }
+    lcm_Coalescer* co = malloc(sizeof(lcm_Coalescer));
+    if (co == NULL) {
+        return NULL;
+    }
+    co->runs = lcm_coalesce_run(max_group);
+    if (co->runs == NULL) {
+        free(co);
+        return NULL;
+    }
+    co->L = L;
+    co->max_group = max_group;
+    co->budget = budget;
+    co->closure_fail = f;
+    co->groups = NULL;
+    co->groups_count = 0;
+    co->groups_capacity = 0;
+    return co;
+}
+
+LCM_API void lcm_coalesce_free(lcm_Coalescer* co)
+{
+    if (co == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < co->groups_count; ++i) {
+        free(co->groups[i].batches);
+        free(co->groups[i].closures);
+    }
+    free(co->groups);
+    while (co->runs != NULL) {
+        lcm_CoalesceRun* next = co->runs->next;
+        free(co->runs);
+        co->runs = next;
+    }
+    free(co);
+}
+
+// Returns group of identified lambda, creating it if missing.
+static lcm_CoalesceGroup* lcm_coalesce_group(
+    lcm_Coalescer* co, int32_t lambda_id)
+{
+    for (size_t i = 0; i < co->groups_count; ++i) {
+        if (co->groups[i].lambda_id == lambda_id) {
+            return &co->groups[i];
+        }
+    }
+    if (co->groups_count == co->groups_capacity) {
+        const size_t capacity
+            = co->groups_capacity > 0 ? co->groups_capacity * 2 : 8;
+        lcm_CoalesceGroup* groups
+            = realloc(co->groups, capacity * sizeof(lcm_CoalesceGroup));
+        if (groups == NULL) {
+            return NULL;
+        }
+        co->groups = groups;
+        co->groups_capacity = capacity;
+    }
+    lcm_CoalesceGroup* g = &co->groups[co->groups_count];
+    g->batches = malloc(co->max_group * sizeof(lcm_Batch));
+    g->closures = malloc(co->max_group * sizeof(lcm_ClosureBatch));
+    if (g->batches == NULL || g->closures == NULL) {
+        free(g->batches);
+        free(g->closures);
+        return NULL;
+    }
+    g->lambda_id = lambda_id;
+    g->count = 0;
+    g->target = 1;
+    g->oldest = 0;
+    g->estimate = 0;
+    g->cost = 0.0;
+    co->groups_count++;
+    return g;
+}
+
+// Sets target size of group `g` from its average cost per batch.
+static void lcm_coalesce_retarget(lcm_Coalescer* co, lcm_CoalesceGroup* g)
+{
+    const double target = g->cost > 0.0 ? (double)co->budget / g->cost : 1.0;
+    g->target = target < 1.0 ? 1
+        : target > (double)co->max_group ? co->max_group
+                                          : (size_t)target;
+}
+
+// Processes all batches in group at `index`, and retunes its target size.
+static size_t lcm_coalesce_dispatch(lcm_Coalescer* co, size_t index)
+{
+    lcm_CoalesceGroup* g = &co->groups[index];
+    const size_t count = g->count;
+    if (count == 0) {
+        return 0;
+    }
+    // Take batches out of group before processing them, as closures may
+    // submit new batches, adding to the group or reallocating all groups.
+    lcm_CoalesceRun* run = co->runs;
+    if (run == NULL && (run = lcm_coalesce_run(co->max_group)) == NULL) {
+        return 0;
+    }
+    co->runs = run->next;
+    memcpy(run->batches, g->batches, count * sizeof(lcm_Batch));
+    memcpy(run->closures, g->closures, count * sizeof(lcm_ClosureBatch));
+    g->count = 0;
+
+    const uint64_t start = lcm_time_now();
+    lcm_processv(co->L, run->batches, run->closures, run->statuses, count);
+    const uint64_t elapsed = lcm_time_now() - start;
+
+    // Track average cost per batch, unless estimated, and make groups as
+    // large as can be processed within the latency budget.
+    g = &co->groups[index];
+    if (g->estimate == 0) {
+        const double cost = (double)elapsed / (double)count;
+        g->cost = g->cost > 0.0 ? g->cost * 0.75 + cost * 0.25 : cost;
+        lcm_coalesce_retarget(co, g);
+    }
+
+    if (co->closure_fail.function != NULL) {
+        for (size_t i = 0; i < count; ++i) {
+            if (run->statuses[i] != 0) {
+                co->closure_fail.function(co->closure_fail.context,
+                    &run->batches[i], run->statuses[i]);
+            }
+        }
+    }
+    run->next = co->runs;
+    co->runs = run;
+    return count;
+}
+
+LCM_API int lcm_coalesce_submit(
+    lcm_Coalescer* co, const lcm_Batch b, lcm_ClosureBatch c)
+{
+    lcm_CoalesceGroup* g = lcm_coalesce_group(co, b.lambda_id);
+    if (g == NULL) {
+        return LCM_ERRMEM;
+    }
+    const size_t index = (size_t)(g - co->groups);
+    if (g->count == co->max_group) {
+        // Group could not be processed when it became full.
+        lcm_coalesce_dispatch(co, index);
+        g = &co->groups[index];
+        if (g->count == co->max_group) {
+            return LCM_ERRMEM;
+        }
+    }
+    if (g->count == 0) {
+        g->oldest = lcm_time_now();
+    }
+    g->batches[g->count] = b;
+    g->closures[g->count] = c;
+    g->count++;
+
+    if (g->count >= g->target) {
+        lcm_coalesce_dispatch(co, index);
+    }
+    return 0;
+}
+
+LCM_API size_t lcm_coalesce_poll(lcm_Coalescer* co)
+{
+    const uint64_t now = lcm_time_now();
+    size_t n = 0;
+    for (size_t i = 0; i < co->groups_count; ++i) {
+        const lcm_CoalesceGroup* g = &co->groups[i];
+        if (g->count > 0 && now - g->oldest >= co->budget) {
+            n += lcm_coalesce_dispatch(co, i);
+        }
+    }
+    return n;
+}
+
+LCM_API size_t lcm_coalesce_flush(lcm_Coalescer* co)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < co->groups_count; ++i) {
+        n += lcm_coalesce_dispatch(co, i);
+    }
+    return n;
+}
+
+LCM_API int lcm_coalesce_estimate(
+    lcm_Coalescer* co, int32_t lambda_id, uint64_t cost)
+{
+    lcm_CoalesceGroup* g = lcm_coalesce_group(co, lambda_id);
+    if (g == NULL) {
+        return LCM_ERRMEM;
+    }
+    g->estimate = cost;
+    g->cost = (double)cost;
+    lcm_coalesce_retarget(co, g);
+    return 0;
+}
+
+LCM_API size_t lcm_coalesce_target(lcm_Coalescer* co, int32_t lambda_id)
+{
+    for (size_t i = 0; i < co->groups_count; ++i) {
+        if (co->groups[i].lambda_id == lambda_id) {
+            return co->groups[i].target;
+        }
+    }
+    return 1;
+}
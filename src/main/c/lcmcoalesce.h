@@ -0,0 +1,89 @@
+/**
+ * Lua/compute batch coalescer header.
+ *
+ * A coalescer collects small batches per lambda ID and processes them in
+ * groups using `lcm_processv()`, which looks up the LCM state object, the
+ * lambda function and its information, and delivers buffered log entries,
+ * once per group rather than once per batch. Groups of lambdas registered with
+ * `LCM_LAMBDA_FVECTOR` are passed to their lambdas in a single Lua call. A
+ * group is processed as soon as it reaches its target size, or when its oldest
+ * batch has waited for longer than the latency budget of the coalescer.
+ *
+ * The target size of each group is tuned automatically, from the measured
+ * average cost of processing its batches, to the number of batches that can
+ * be processed within the latency budget, unless a fixed cost estimate has
+ * been provided using `lcm_coalesce_estimate()`.
+ *
+ * The coalescer has no thread of its own. Waiting groups are only processed
+ * when `lcm_coalesce_submit()`, `lcm_coalesce_poll()` or
+ * `lcm_coalesce_flush()` is called. The batches of a group are taken out of
+ * it before being processed, which means that result and failure closures
+ * may submit, poll and flush batches using the same coalescer, but they must
+ * not free it.
+ *
+ * @file
+ */
+#ifndef lcmcoalesce_h
+#define lcmcoalesce_h
+
+#include "lcm.h"
+
+typedef struct lcm_Coalescer lcm_Coalescer;
+
+/**
+ * Creates coalescer processing batches using Lua state `L`.
+ *
+ * No group will contain more than `max_group` batches, and no batch is held
+ * for longer than `budget` nanoseconds, provided that the coalescer is polled
+ * often enough. Batches failing to be processed are provided to `f`, if it
+ * contains a function.
+ *
+ * Returns NULL if memory could not be allocated.
+ */
+LCM_API lcm_Coalescer* lcm_coalesce_new(
+    lua_State* L, size_t max_group, uint64_t budget, lcm_ClosureFail f);
+
+/** Destroys coalescer. Any waiting batches are discarded. */
+LCM_API void lcm_coalesce_free(lcm_Coalescer* co);
+
+/**
+ * Adds batch `b` to the group of its lambda, and processes the group if it
+ * reached its target size. The memory referenced by `b` must remain valid
+ * until the batch has been processed. Results are provided to `c`, as with
+ * `lcm_process()`.
+ *
+ * Returns `0` (OK) or `LCM_ERRMEM`.
+ */
+LCM_API int lcm_coalesce_submit(
+    lcm_Coalescer* co, const lcm_Batch b, lcm_ClosureBatch c);
+
+/**
+ * Processes all groups whose oldest batch has waited for at least the latency
+ * budget of the coalescer.
+ *
+ * Returns the number of batches processed, including failed ones.
+ */
+LCM_API size_t lcm_coalesce_poll(lcm_Coalescer* co);
+
+/**
+ * Processes all waiting batches, regardless of how long they have waited.
+ *
+ * Returns the number of batches processed, including failed ones.
+ */
+LCM_API size_t lcm_coalesce_flush(lcm_Coalescer* co);
+
+/**
+ * Makes coalescer assume that processing each batch of identified lambda
+ * takes `cost` nanoseconds, rather than measuring it, and sets the target size
+ * of its group accordingly. A `cost` of `0` makes the coalescer measure the
+ * cost again, starting from the next group processed.
+ *
+ * Returns `0` (OK) or `LCM_ERRMEM`.
+ */
+LCM_API int lcm_coalesce_estimate(
+    lcm_Coalescer* co, int32_t lambda_id, uint64_t cost);
+
+/** Returns current target group size of identified lambda. */
+LCM_API size_t lcm_coalesce_target(lcm_Coalescer* co, int32_t lambda_id);
+
+#endif
@@ -0,0 +1,103 @@
+#include "lcmcodec.h"
+#include <string.h>
+
+// Initial size of scratch buffers, in bytes.
+#define LCM_SCRATCH_SIZE 4096
+
+// Converts relative stack index into an absolute one.
+#define ABSINDEX(L, i) ((i) > 0 ? (i) : lua_gettop(L) + (i) + 1)
+
+// Replaces scratch buffer `s` with one of at least `size` bytes. The buffer is
+// kept alive by slot `slot` of the table at stack index `scratch`, or, if
+// `scratch` is `0`, by being left on the stack in place of any buffer already
+// left there.
+static void lcm_scratch_grow(
+    lua_State* L, int scratch, lcm_Scratch* s, int slot, size_t size)
+{
+    if (scratch == 0) {
+        if (s->bytes != NULL) {
+            lua_pop(L, 1);
+        }
+        s->bytes = lua_newuserdata(L, size);
+        s->size = size;
+        return;
+    }
+    if (size < s->size * 2) {
+        size = s->size * 2;
+    }
+    if (size < LCM_SCRATCH_SIZE) {
+        size = LCM_SCRATCH_SIZE;
+    }
+    s->bytes = lua_newuserdata(L, size);
+    s->size = size;
+    lua_rawseti(L, scratch, slot);
+}
+
+lcm_Codecs* lcm_codecs_new(lua_State* L, const lcm_Codec* list, size_t count)
+{
+    lcm_Codecs* cs = lua_newuserdata(L, sizeof(lcm_Codecs)
+            + count * sizeof(lcm_Codec));
+    cs->decoded = (lcm_Scratch){.bytes = NULL, .size = 0 };
+    cs->encoded = (lcm_Scratch){.bytes = NULL, .size = 0 };
+    cs->count = count;
+    memcpy(cs->list, list, count * sizeof(lcm_Codec));
+    return cs;
+}
+
+// Runs codec function `f` on `in`, writing output to scratch buffer `s`, which
+// is grown and `f` called again if too small.
+static int lcm_codecs_run(lua_State* L, lcm_FunctionCode f, void* context,
+    int scratch, lcm_Scratch* s, int slot, const uint8_t* in,
+    size_t in_length, const uint8_t** out, size_t* out_length)
+{
+    if (scratch != 0) {
+        scratch = ABSINDEX(L, scratch);
+    }
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        const size_t length = f(context, in, in_length, s->bytes, s->size);
+        if (length == SIZE_MAX) {
+            break;
+        }
+        if (length <= s->size) {
+            *out = s->bytes;
+            *out_length = length;
+            return 0;
+        }
+        lcm_scratch_grow(L, scratch, s, slot, length);
+    }
+    return LCM_ERRCODEC;
+}
+
+int lcm_codecs_decode(lua_State* L, lcm_Codecs* cs, int scratch,
+    int32_t encoding, const uint8_t* in, size_t in_length,
+    const uint8_t** out, size_t* out_length)
+{
+    if (encoding < 1 || (size_t)encoding > cs->count
+        || cs->list[encoding - 1].decode == NULL) {
+        return LCM_ERRCODEC;
+    }
+    const lcm_Codec* codec = &cs->list[encoding - 1];
+    return lcm_codecs_run(L, codec->decode, codec->context, scratch,
+        &cs->decoded, 1, in, in_length, out, out_length);
+}
+
+int lcm_codecs_encode(lua_State* L, lcm_Codecs* cs, int scratch,
+    int32_t encoding, const uint8_t* in, size_t in_length,
+    const uint8_t** out, size_t* out_length)
+{
+    if (encoding < 1 || (size_t)encoding > cs->count
+        || cs->list[encoding - 1].encode == NULL) {
+        return LCM_ERRCODEC;
+    }
+    const lcm_Codec* codec = &cs->list[encoding - 1];
+    if (scratch == 0) {
+        // Start with a buffer as large as the input, and leave it, or the
+        // buffer it is replaced by, on the stack.
+        lcm_Scratch s = {.bytes = NULL, .size = 0 };
+        lcm_scratch_grow(L, 0, &s, 0, in_length);
+        return lcm_codecs_run(L, codec->encode, codec->context, 0, &s, 0, in,
+            in_length, out, out_length);
+    }
+    return lcm_codecs_run(L, codec->encode, codec->context, scratch,
+        &cs->encoded, 2, in, in_length, out, out_length);
+}
@@ -0,0 +1,66 @@
+/**
+ * Lua/compute batch codec header.
+ *
+ * Holds the codecs configured for a Lua state, as well as two scratch buffers,
+ * one for decoded batch data and one for encoded results. The scratch buffers
+ * grow as needed, and are reused by every processed batch. They are kept alive
+ * by a table provided by the caller, holding nothing else.
+ *
+ * @file
+ */
+#ifndef lcmcodec_h
+#define lcmcodec_h
+
+#include "lcm.h"
+
+/** Reusable byte buffer. */
+typedef struct {
+    uint8_t* bytes;
+    size_t size;
+} lcm_Scratch;
+
+/** Configured codecs and their scratch buffers. */
+typedef struct {
+    lcm_Scratch decoded, encoded;
+    size_t count;
+    lcm_Codec list[];
+} lcm_Codecs;
+
+/**
+ * Copies provided codecs into new object pushed onto the stack of `L`.
+ *
+ * Scratch buffers are allocated when first needed.
+ */
+lcm_Codecs* lcm_codecs_new(lua_State* L, const lcm_Codec* list, size_t count);
+
+/**
+ * Decodes `in` using identified encoding of codecs `cs`, making `out` point to
+ * the decoded bytes.
+ *
+ * The decoded bytes are written to a scratch buffer kept alive by the table at
+ * stack index `scratch`, and remain valid until the next call to this
+ * function.
+ *
+ * Returns `0` (OK) or `LCM_ERRCODEC`.
+ */
+int lcm_codecs_decode(lua_State* L, lcm_Codecs* cs, int scratch,
+    int32_t encoding, const uint8_t* in, size_t in_length,
+    const uint8_t** out, size_t* out_length);
+
+/**
+ * Encodes `in` using identified encoding of codecs `cs`, making `out` point to
+ * the encoded bytes.
+ *
+ * If `scratch` is a stack index, the encoded bytes are written to a scratch
+ * buffer kept alive by the table at that index, and remain valid until the
+ * next call to this function. If `scratch` is `0`, they are instead written to
+ * a new buffer pushed onto the stack of `L`, and remain valid while it is kept
+ * there, which allows for encoding while the scratch buffer is in use.
+ *
+ * Returns `0` (OK) or `LCM_ERRCODEC`.
+ */
+int lcm_codecs_encode(lua_State* L, lcm_Codecs* cs, int scratch,
+    int32_t encoding, const uint8_t* in, size_t in_length,
+    const uint8_t** out, size_t* out_length);
+
+#endif
@@ -21,6 +21,71 @@
 #define LCM_ERRNOCALL (LCM_ERR + 2) ///< `lcm:register()` never called.
 #define LCM_ERRNOLAMBDA (LCM_ERR + 3) //< Required lambda not available.
 #define LCM_ERRNORESULT (LCM_ERR + 4) ///< No result produced.
+#define LCM_ERRNOSUPPORT (LCM_ERR + 5) ///< Feature not compiled in.
+#define LCM_ERRIO (LCM_ERR + 6) ///< Read or write closure failed.
+#define LCM_ERREXPIRED (LCM_ERR + 7) ///< Batch deadline expired.
+#define LCM_ERRFULL (LCM_ERR + 8) ///< Queue full.
+#define LCM_ERRCODEC (LCM_ERR + 9) ///< Batch encoding or decoding failed.
+#define LCM_ERRCRASH (LCM_ERR + 10) ///< Worker process crashed.
+#define LCM_ERRSTATE (LCM_ERR + 11) ///< Lambda state not serializable.
+#define LCM_ERRNOPERF (LCM_ERR + 12) ///< Performance counters unavailable.
 ///}
 
+///{ Lambda flags. Combine using bitwise OR in `lcm_Lambda.flags`.
+#define LCM_LAMBDA_FPURE 0x01 ///< Results depend only on batch data.
+#define LCM_LAMBDA_FVECTOR 0x02 ///< Takes and returns tables of batch data.
+///}
+
+///{ Log levels. Used with `lcm:log()`, where they are also available as
+///  `lcm.DEBUG`, `lcm.INFO`, `lcm.WARN` and `lcm.ERROR`.
+#define LCM_LOG_DEBUG 10
+#define LCM_LOG_INFO 20 ///< Used if `lcm:log()` is called without a level.
+#define LCM_LOG_WARN 30
+#define LCM_LOG_ERROR 40
+///}
+
+/** Default size of log buffers, in bytes. */
+#ifndef LCM_LOG_BUFFER_SIZE
+#define LCM_LOG_BUFFER_SIZE 65536
+#endif
+
+///{ Hardware counter flags. Set in `lcm_PerfStats.available` for each counter
+///  that could be opened.
+#define LCM_PERF_FCYCLES 0x01
+#define LCM_PERF_FINSTRUCTIONS 0x02
+#define LCM_PERF_FLLCMISSES 0x04
+#define LCM_PERF_FBRANCHMISSES 0x08
+///}
+
+///{ Checkpoint flags. Combine using bitwise OR in `lcm_checkpoint()` calls.
+#define LCM_CHECKPOINT_FDELTA 0x01 ///< Only include changes since last call.
+///}
+
+/** Maximum nesting depth of tables in lambda state. */
+#ifndef LCM_STATE_DEPTH
+#define LCM_STATE_DEPTH 32
+#endif
+
+/** Batch encoding of plain, unencoded, batches. */
+#define LCM_ENCODING_RAW 0
+
+///{ LuaJIT compilation modes. Used in `lcm_Lambda.jit.mode`.
+#define LCM_JIT_DEFAULT 0 ///< Leave JIT compilation setting untouched.
+#define LCM_JIT_ON 1 ///< Enable JIT compilation of lambda.
+#define LCM_JIT_OFF 2 ///< Disable JIT compilation of lambda.
+///}
+
+/** Number of slots in each result cache set. */
+#ifndef LCM_CACHE_WAYS
+#define LCM_CACHE_WAYS 4
+#endif
+
+/**
+ * Define `LCM_USE_TRACE` to compile in recording of processing phase timings,
+ * and `LCM_USE_SDT` to have each recorded phase fire a USDT probe.
+ */
+#ifndef LCM_TRACE_CAPACITY
+#define LCM_TRACE_CAPACITY 4096 ///< Number of events kept per Lua state.
+#endif
+
 #endif
@@ -0,0 +1,917 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "lcmfarm.h"
+
+#ifdef __linux__
+#include "lcmtime.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LCM_FARM_MAGIC 0x464d434c
+#define LCM_FARM_ALIGN(size) (((size) + 7) & ~(uint64_t)7)
+
+/** Longest time waited without checking for crashed workers. */
+#define LCM_FARM_WAIT_SLICE 10000000
+
+/**
+ * Time waited before restarting worker exiting without having responded to
+ * any request, doubled for every consecutive such exit.
+ */
+#define LCM_FARM_BACKOFF 1000000
+
+/** Consecutive restarts of unresponsive worker before giving up on it. */
+#define LCM_FARM_RETRIES 8
+
+#define LCM_LOAD(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define LCM_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+
+///{ Message types.
+#define LCM_FARM_SKIP 1 ///< Padding up to end of ring.
+#define LCM_FARM_LAMBDA 2 ///< Lambda to register. Parent to worker.
+#define LCM_FARM_BATCH 3 ///< Batch to process. Parent to worker.
+#define LCM_FARM_RESULT 4 ///< Result of batch. Worker to parent.
+#define LCM_FARM_REGISTERED 5 ///< Registration status. Worker to parent.
+///}
+
+/** Ring message header, followed by `length` bytes of payload. */
+typedef struct {
+    uint32_t size; ///< Header and payload size, rounded up to alignment.
+    uint32_t type;
+    int32_t lambda_id, batch_id;
+    int32_t value; ///< Lambda flags, batch encoding or result status.
+    uint32_t length;
+} lcm_FarmMessage;
+
+/** Futex word, incremented whenever its waiters are to wake up. */
+typedef struct {
+    uint32_t word;
+    uint32_t waiters;
+} lcm_FarmSignal;
+
+/**
+ * Single-producer single-consumer ring of messages. Positions grow without
+ * wrapping around, and are taken modulo ring size when used.
+ */
+typedef struct {
+    uint64_t head, tail;
+    lcm_FarmSignal data, space;
+} lcm_FarmRing;
+
+/** Shared memory header. Followed by the ring data of every worker. */
+typedef struct {
+    uint32_t magic;
+    uint32_t workers;
+    uint32_t ring_size;
+    uint32_t padding;
+    lcm_FarmSignal results;
+    struct {
+        lcm_FarmRing requests, responses;
+    } channels[];
+} lcm_FarmShared;
+
+/** Batch submitted to worker and not yet completed. */
+typedef struct {
+    int32_t lambda_id, batch_id, encoding;
+    lcm_ClosureBatch closure;
+} lcm_FarmPending;
+
+/**
+ * Worker process. Its `pid` is `0` while waiting to be restarted, and `-1` if
+ * it could not be started.
+ */
+typedef struct {
+    pid_t pid;
+    lcm_FarmRing* requests;
+    lcm_FarmRing* responses;
+    uint8_t* requests_data;
+    uint8_t* responses_data;
+    lcm_FarmPending* pending;
+    size_t pending_head, pending_count;
+    size_t resend;
+    int ack;
+    int responded; ///< Whether worker responded since last started.
+    int corrupt; ///< Whether worker wrote invalid response, and was killed.
+    int failed; ///< Whether worker was given up on.
+    unsigned retries; ///< Consecutive restarts without response.
+    uint64_t restart_at;
+} lcm_FarmWorker;
+
+/** Lambda registered with farm, kept for restarted workers. */
+typedef struct {
+    int32_t lambda_id;
+    uint32_t flags;
+    char* lua;
+    size_t length;
+} lcm_FarmLambda;
+
+struct lcm_Farm {
+    char* path;
+    int fd;
+    lcm_FarmShared* shared;
+    size_t shared_size;
+    uint32_t ring_size;
+    lcm_ClosureFail closure_fail;
+    lcm_FarmWorker* workers;
+    size_t workers_count;
+    size_t pending_capacity;
+    lcm_FarmLambda* lambdas;
+    size_t lambdas_count, lambdas_capacity;
+    int32_t registering;
+    lcm_FarmMessage* reserved;
+    lcm_FarmWorker* reserved_worker;
+    size_t count;
+    uint64_t restarts;
+    size_t failed;
+};
+
+static void lcm_farm_notify(lcm_FarmSignal* s)
+{
+    __atomic_add_fetch(&s->word, 1, __ATOMIC_SEQ_CST);
+    if (LCM_LOAD(&s->waiters) > 0) {
+        syscall(SYS_futex, &s->word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+// Waits until `s` is notified after its word was read as `seen`, or until
+// `timeout` nanoseconds have passed. `UINT64_MAX` waits indefinitely.
+static void lcm_farm_await(lcm_FarmSignal* s, uint32_t seen, uint64_t timeout)
+{
+    const struct timespec ts = {
+        .tv_sec = (time_t)(timeout / 1000000000),
+        .tv_nsec = (long)(timeout % 1000000000),
+    };
+    __atomic_add_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &s->word, FUTEX_WAIT, seen,
+        timeout != UINT64_MAX ? &ts : NULL, NULL, 0);
+    __atomic_sub_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+// Skips `skip` bytes at ring head, up to the end of the ring.
+static void lcm_farm_skip(lcm_FarmRing* r, uint8_t* data, uint32_t capacity,
+    uint64_t head, uint64_t skip)
+{
+    if (skip >= sizeof(lcm_FarmMessage)) {
+        lcm_FarmMessage* m = (lcm_FarmMessage*)&data[head % capacity];
+        m->size = (uint32_t)skip;
+        m->type = LCM_FARM_SKIP;
+    }
+    LCM_STORE(&r->head, head + skip);
+}
+
+// Reserves room for message with `length` bytes of payload at ring head.
+// Returns NULL if there is not enough room.
+static lcm_FarmMessage* lcm_farm_reserve(
+    lcm_FarmRing* r, uint8_t* data, uint32_t capacity, size_t length)
+{
+    if (length > capacity) {
+        return NULL;
+    }
+    const uint64_t size = LCM_FARM_ALIGN(sizeof(lcm_FarmMessage) + length);
+    const uint64_t head = LCM_LOAD(&r->head);
+    const uint64_t tail = LCM_LOAD(&r->tail);
+    const uint64_t contiguous = capacity - head % capacity;
+
+    // Messages never wrap around. If not fitting before the end of the ring,
+    // the rest of the ring is skipped.
+    const uint64_t skip = contiguous < size ? contiguous : 0;
+    if (size > capacity) {
+        return NULL;
+    }
+    if (head + skip + size - tail > capacity) {
+        // A message larger than half the ring may only fit once the consumer
+        // has passed the end of the ring, which is skipped at once if empty.
+        if (skip > 0 && head == tail) {
+            lcm_farm_skip(r, data, capacity, head, skip);
+            lcm_farm_notify(&r->data);
+        }
+        return NULL;
+    }
+    if (skip > 0) {
+        lcm_farm_skip(r, data, capacity, head, skip);
+    }
+    lcm_FarmMessage* m = (lcm_FarmMessage*)&data[(head + skip) % capacity];
+    m->size = (uint32_t)size;
+    m->length = (uint32_t)length;
+    return m;
+}
+
+// Makes reserved message `m` available to consumer.
+static void lcm_farm_publish(lcm_FarmRing* r, const lcm_FarmMessage* m)
+{
+    LCM_STORE(&r->head, LCM_LOAD(&r->head) + m->size);
+    lcm_farm_notify(&r->data);
+}
+
+// Points `*m` at message at ring tail, or at NULL if the ring is empty, and
+// copies its header into `h`. As the producer of the ring may be faulty, the
+// copied header is only used after making sure that it describes a message
+// within the bytes available in the ring. Returns non-zero if not.
+static int lcm_farm_peek(lcm_FarmRing* r, uint8_t* data, uint32_t capacity,
+    lcm_FarmMessage** m, lcm_FarmMessage* h)
+{
+    *m = NULL;
+    for (;;) {
+        const uint64_t tail = LCM_LOAD(&r->tail);
+        const uint64_t used = LCM_LOAD(&r->head) - tail;
+        if (used == 0) {
+            return 0;
+        }
+        const uint64_t contiguous = capacity - tail % capacity;
+        if (used > capacity) {
+            return 1;
+        }
+        if (contiguous < sizeof(lcm_FarmMessage)) {
+            if (used < contiguous) {
+                return 1;
+            }
+            LCM_STORE(&r->tail, tail + contiguous);
+            lcm_farm_notify(&r->space);
+            continue;
+        }
+        lcm_FarmMessage* p = (lcm_FarmMessage*)&data[tail % capacity];
+        memcpy(h, p, sizeof(lcm_FarmMessage));
+        if (h->size != LCM_FARM_ALIGN(h->size)
+            || h->size < sizeof(lcm_FarmMessage) || h->size > used
+            || h->size > contiguous) {
+            return 1;
+        }
+        if (h->type == LCM_FARM_SKIP) {
+            LCM_STORE(&r->tail, tail + h->size);
+            lcm_farm_notify(&r->space);
+            continue;
+        }
+        if (h->length > h->size - sizeof(lcm_FarmMessage)) {
+            return 1;
+        }
+        *m = p;
+        return 0;
+    }
+}
+
+// Removes message with header `h`, copied by `lcm_farm_peek()`, from ring.
+static void lcm_farm_consume(lcm_FarmRing* r, const lcm_FarmMessage* h)
+{
+    LCM_STORE(&r->tail, LCM_LOAD(&r->tail) + h->size);
+    lcm_farm_notify(&r->space);
+}
+
+// Points ring fields of `w` at shared memory of worker `index`.
+static void lcm_farm_bind(lcm_FarmWorker* w, lcm_FarmShared* shared,
+    size_t index, uint32_t ring_size)
+{
+    uint8_t* data = (uint8_t*)&shared->channels[shared->workers];
+    w->requests = &shared->channels[index].requests;
+    w->responses = &shared->channels[index].responses;
+    w->requests_data = &data[index * 2 * ring_size];
+    w->responses_data = &data[(index * 2 + 1) * ring_size];
+}
+
+// Queues registration of lambdas not yet sent to worker, as long as there is
+// room in its request ring.
+static void lcm_farm_resend(lcm_Farm* f, lcm_FarmWorker* w)
+{
+    for (; w->resend < f->lambdas_count; ++w->resend) {
+        const lcm_FarmLambda* l = &f->lambdas[w->resend];
+        lcm_FarmMessage* m = lcm_farm_reserve(
+            w->requests, w->requests_data, f->ring_size, l->length);
+        if (m == NULL) {
+            return;
+        }
+        m->type = LCM_FARM_LAMBDA;
+        m->lambda_id = l->lambda_id;
+        m->batch_id = 0;
+        m->value = (int32_t)l->flags;
+        memcpy(m + 1, l->lua, l->length);
+        lcm_farm_publish(w->requests, m);
+    }
+}
+
+// Starts worker process with empty rings. Lambdas are registered again by
+// `lcm_farm_resend()`.
+static void lcm_farm_spawn(lcm_Farm* f, lcm_FarmWorker* w)
+{
+    *w->requests = (lcm_FarmRing){.head = 0 };
+    *w->responses = (lcm_FarmRing){.head = 0 };
+    w->pending_head = 0;
+    w->pending_count = 0;
+    w->resend = 0;
+    w->responded = 0;
+    w->corrupt = 0;
+
+    char fd[16], index[16];
+    snprintf(fd, sizeof(fd), "%d", f->fd);
+    snprintf(index, sizeof(index), "%zu", (size_t)(w - f->workers));
+
+    w->pid = fork();
+    if (w->pid == 0) {
+        // Only workers inherit the shared memory file descriptor, rather than
+        // every program executed by the parent process.
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        fcntl(f->fd, F_SETFD, 0);
+        execl(f->path, f->path, fd, index, (char*)NULL);
+        _exit(127);
+    }
+    lcm_farm_resend(f, w);
+}
+
+// Reports all batches in flight in worker as failed with `status`.
+static size_t lcm_farm_fail(lcm_Farm* f, lcm_FarmWorker* w, int status)
+{
+    const size_t n = w->pending_count;
+    for (; w->pending_count > 0; --w->pending_count) {
+        const lcm_FarmPending* p = &w->pending[w->pending_head];
+        w->pending_head = (w->pending_head + 1) % f->pending_capacity;
+        if (f->closure_fail.function != NULL) {
+            const lcm_Batch b = {
+                .lambda_id = p->lambda_id,
+                .batch_id = p->batch_id,
+                .encoding = p->encoding,
+            };
+            f->closure_fail.function(f->closure_fail.context, &b, status);
+        }
+    }
+    f->count -= n;
+    return n;
+}
+
+// Delivers all responses available in response ring of worker. A worker
+// writing an invalid response is killed, making it be restarted as if it had
+// crashed, and its ring is not read any further.
+static size_t lcm_farm_deliver(lcm_Farm* f, lcm_FarmWorker* w)
+{
+    size_t n = 0;
+    lcm_FarmMessage* m;
+    lcm_FarmMessage h;
+    while (!w->corrupt) {
+        if (lcm_farm_peek(
+                w->responses, w->responses_data, f->ring_size, &m, &h)
+            != 0) {
+            w->corrupt = 1;
+            if (w->pid > 0) {
+                kill(w->pid, SIGKILL);
+            }
+            break;
+        }
+        if (m == NULL) {
+            break;
+        }
+        w->responded = 1;
+        if (h.type == LCM_FARM_REGISTERED) {
+            if (h.lambda_id == f->registering) {
+                w->ack = h.value;
+            }
+        } else if (h.type == LCM_FARM_RESULT && w->pending_count > 0) {
+            const lcm_FarmPending p = w->pending[w->pending_head];
+            w->pending_head = (w->pending_head + 1) % f->pending_capacity;
+            w->pending_count--;
+            f->count--;
+            n++;
+
+            lcm_Batch b = {
+                .lambda_id = p.lambda_id,
+                .batch_id = p.batch_id,
+                .encoding = p.encoding,
+            };
+            if (h.value == 0) {
+                b.data.bytes = (uint8_t*)(m + 1);
+                b.data.length = h.length;
+                p.closure.function(p.closure.context, &b);
+            } else if (f->closure_fail.function != NULL) {
+                f->closure_fail.function(f->closure_fail.context, &b, h.value);
+            }
+        }
+        lcm_farm_consume(w->responses, &h);
+    }
+    return n;
+}
+
+// Returns worker with fewest batches in flight and room for more, or NULL.
+// Workers still resending lambdas are not chosen, as their batches would
+// otherwise be queued ahead of the lambdas processing them.
+static lcm_FarmWorker* lcm_farm_choose(lcm_Farm* f)
+{
+    lcm_FarmWorker* best = NULL;
+    for (size_t i = 0; i < f->workers_count; ++i) {
+        lcm_FarmWorker* w = &f->workers[i];
+        if (w->pid > 0 && w->resend == f->lambdas_count
+            && w->pending_count < f->pending_capacity
+            && (best == NULL || w->pending_count < best->pending_count)) {
+            best = w;
+        }
+    }
+    return best;
+}
+
+LCM_API lcm_Farm* lcm_farm_new(
+    const char* path, size_t workers, size_t ring_size, lcm_ClosureFail f)
+{
+    if (workers == 0 || ring_size > UINT32_MAX / 2
+        || access(path, X_OK) != 0) {
+        return NULL;
+    }
+    ring_size = LCM_FARM_ALIGN(ring_size);
+    if (ring_size < 2 * sizeof(lcm_FarmMessage)) {
+        ring_size = 2 * sizeof(lcm_FarmMessage);
+    }
+    lcm_Farm* farm = calloc(1, sizeof(lcm_Farm));
+    if (farm == NULL) {
+        return NULL;
+    }
+    farm->fd = -1;
+    farm->shared = MAP_FAILED;
+    farm->ring_size = (uint32_t)ring_size;
+    farm->closure_fail = f;
+    farm->registering = -1;
+
+    // Every batch in flight occupies at least one message header in either
+    // the request or the response ring of its worker.
+    farm->pending_capacity = 2 * ring_size / sizeof(lcm_FarmMessage);
+
+    farm->path = malloc(strlen(path) + 1);
+    farm->workers = calloc(workers, sizeof(lcm_FarmWorker));
+    if (farm->path == NULL || farm->workers == NULL) {
+        goto fail;
+    }
+    strcpy(farm->path, path);
+    farm->workers_count = workers;
+    for (size_t i = 0; i < workers; ++i) {
+        farm->workers[i].pending
+            = malloc(farm->pending_capacity * sizeof(lcm_FarmPending));
+        if (farm->workers[i].pending == NULL) {
+            goto fail;
+        }
+    }
+    // Create shared memory. The file descriptor is made inheritable only by
+    // workers, when they are started.
+    farm->shared_size = sizeof(lcm_FarmShared)
+        + workers * sizeof(farm->shared->channels[0])
+        + workers * 2 * ring_size;
+    farm->fd = (int)syscall(SYS_memfd_create, "lcm_farm", MFD_CLOEXEC);
+    if (farm->fd < 0 || ftruncate(farm->fd, (off_t)farm->shared_size) != 0) {
+        goto fail;
+    }
+    farm->shared = mmap(NULL, farm->shared_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, farm->fd, 0);
+    if (farm->shared == MAP_FAILED) {
+        goto fail;
+    }
+    farm->shared->magic = LCM_FARM_MAGIC;
+    farm->shared->workers = (uint32_t)workers;
+    farm->shared->ring_size = (uint32_t)ring_size;
+
+    for (size_t i = 0; i < workers; ++i) {
+        lcm_FarmWorker* w = &farm->workers[i];
+        lcm_farm_bind(w, farm->shared, i, farm->ring_size);
+        lcm_farm_spawn(farm, w);
+        if (w->pid < 0) {
+            goto fail;
+        }
+    }
+    return farm;
+
+fail:
+    lcm_farm_free(farm);
+    return NULL;
+}
+
+LCM_API void lcm_farm_free(lcm_Farm* f)
+{
+    if (f == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < f->workers_count; ++i) {
+        lcm_FarmWorker* w = &f->workers[i];
+        if (w->pid > 0) {
+            kill(w->pid, SIGKILL);
+            waitpid(w->pid, NULL, 0);
+        }
+        free(w->pending);
+    }
+    for (size_t i = 0; i < f->lambdas_count; ++i) {
+        free(f->lambdas[i].lua);
+    }
+    if (f->shared != MAP_FAILED) {
+        munmap(f->shared, f->shared_size);
+    }
+    if (f->fd >= 0) {
+        close(f->fd);
+    }
+    free(f->lambdas);
+    free(f->workers);
+    free(f->path);
+    free(f);
+}
+
+LCM_API int lcm_farm_register(lcm_Farm* f, const lcm_Lambda l)
+{
+    if (l.program.length > f->ring_size - sizeof(lcm_FarmMessage)) {
+        return LCM_ERRFULL;
+    }
+    // Save copy of lambda, replacing any with the same ID.
+    size_t i = 0;
+    while (i < f->lambdas_count && f->lambdas[i].lambda_id != l.lambda_id) {
+        i++;
+    }
+    if (i == f->lambdas_capacity) {
+        const size_t capacity
+            = f->lambdas_capacity > 0 ? f->lambdas_capacity * 2 : 8;
+        lcm_FarmLambda* lambdas
+            = realloc(f->lambdas, capacity * sizeof(lcm_FarmLambda));
+        if (lambdas == NULL) {
+            return LCM_ERRMEM;
+        }
+        f->lambdas = lambdas;
+        f->lambdas_capacity = capacity;
+    }
+    char* lua = malloc(l.program.length > 0 ? l.program.length : 1);
+    if (lua == NULL) {
+        return LCM_ERRMEM;
+    }
+    memcpy(lua, l.program.lua, l.program.length);
+    if (i == f->lambdas_count) {
+        f->lambdas_count++;
+    } else {
+        free(f->lambdas[i].lua);
+
+        // Make workers send the replacement, even if they already sent the
+        // replaced lambda.
+        for (size_t j = 0; j < f->workers_count; ++j) {
+            if (f->workers[j].resend > i) {
+                f->workers[j].resend = i;
+            }
+        }
+    }
+    f->lambdas[i] = (lcm_FarmLambda){
+        .lambda_id = l.lambda_id,
+        .flags = l.flags,
+        .lua = lua,
+        .length = l.program.length,
+    };
+    // Send lambda to all workers and wait for them to acknowledge it.
+    f->registering = l.lambda_id;
+    for (size_t j = 0; j < f->workers_count; ++j) {
+        f->workers[j].ack = -1;
+    }
+    int status = 0;
+    for (size_t j = 0; j < f->workers_count; ++j) {
+        lcm_FarmWorker* w = &f->workers[j];
+        while (w->ack == -1 && !w->failed) {
+            lcm_farm_resend(f, w);
+            const pid_t pid = w->pid;
+            lcm_farm_wait(f, LCM_FARM_WAIT_SLICE);
+            if (w->pid != pid && w->ack == -1) {
+                w->ack = LCM_ERRCRASH;
+            }
+        }
+        if (status == 0 && !w->failed) {
+            status = w->ack;
+        }
+    }
+    f->registering = -1;
+    return f->failed < f->workers_count ? status : LCM_ERRCRASH;
+}
+
+LCM_API uint8_t* lcm_farm_alloc(lcm_Farm* f, size_t length)
+{
+    f->reserved = NULL;
+    lcm_FarmWorker* w = lcm_farm_choose(f);
+    if (w == NULL) {
+        return NULL;
+    }
+    lcm_FarmMessage* m
+        = lcm_farm_reserve(w->requests, w->requests_data, f->ring_size, length);
+    if (m == NULL) {
+        return NULL;
+    }
+    f->reserved = m;
+    f->reserved_worker = w;
+    return (uint8_t*)(m + 1);
+}
+
+LCM_API int lcm_farm_submit(
+    lcm_Farm* f, const lcm_Batch b, lcm_ClosureBatch c)
+{
+    lcm_FarmWorker* w;
+    lcm_FarmMessage* m;
+    if (f->reserved != NULL && b.data.bytes == (uint8_t*)(f->reserved + 1)
+        && b.data.length <= f->reserved->length) {
+        w = f->reserved_worker;
+        m = f->reserved;
+        m->length = (uint32_t)b.data.length;
+    } else {
+        w = lcm_farm_choose(f);
+        if (w == NULL) {
+            return f->failed < f->workers_count ? LCM_ERRFULL : LCM_ERRCRASH;
+        }
+        m = lcm_farm_reserve(
+            w->requests, w->requests_data, f->ring_size, b.data.length);
+        if (m == NULL) {
+            return LCM_ERRFULL;
+        }
+        memcpy(m + 1, b.data.bytes, b.data.length);
+    }
+    f->reserved = NULL;
+
+    m->type = LCM_FARM_BATCH;
+    m->lambda_id = b.lambda_id;
+    m->batch_id = b.batch_id;
+    m->value = b.encoding;
+
+    const size_t tail
+        = (w->pending_head + w->pending_count++) % f->pending_capacity;
+    w->pending[tail] = (lcm_FarmPending){
+        .lambda_id = b.lambda_id,
+        .batch_id = b.batch_id,
+        .encoding = b.encoding,
+        .closure = c,
+    };
+    f->count++;
+
+    lcm_farm_publish(w->requests, m);
+    return 0;
+}
+
+LCM_API size_t lcm_farm_poll(lcm_Farm* f)
+{
+    // Resent lambdas may take the place of any reserved memory.
+    f->reserved = NULL;
+
+    size_t n = 0;
+    for (size_t i = 0; i < f->workers_count; ++i) {
+        lcm_FarmWorker* w = &f->workers[i];
+        if (w->failed) {
+            continue;
+        }
+        n += lcm_farm_deliver(f, w);
+
+        // Schedule restart of worker if it has exited, after delivering any
+        // results it managed to produce before exiting. Workers exiting
+        // without ever responding are likely to do so again, and are
+        // restarted after a growing delay until given up on.
+        if (w->pid < 0
+            || (w->pid > 0 && waitpid(w->pid, NULL, WNOHANG) == w->pid)) {
+            w->pid = 0;
+            n += lcm_farm_deliver(f, w);
+            n += lcm_farm_fail(f, w, LCM_ERRCRASH);
+            w->retries = w->responded ? 0 : w->retries + 1;
+            if (w->retries > LCM_FARM_RETRIES) {
+                w->failed = 1;
+                f->failed++;
+                continue;
+            }
+            const uint64_t delay = w->retries > 0
+                ? (uint64_t)LCM_FARM_BACKOFF << (w->retries - 1)
+                : 0;
+            w->restart_at = lcm_time_now() + delay;
+        }
+        if (w->pid == 0) {
+            if (lcm_time_now() >= w->restart_at) {
+                lcm_farm_spawn(f, w);
+                f->restarts++;
+            }
+        } else {
+            lcm_farm_resend(f, w);
+        }
+    }
+    return n;
+}
+
+LCM_API size_t lcm_farm_wait(lcm_Farm* f, uint64_t timeout)
+{
+    const uint64_t end = lcm_time_now() + timeout;
+    for (;;) {
+        const uint32_t seen = LCM_LOAD(&f->shared->results.word);
+        const size_t n = lcm_farm_poll(f);
+        const uint64_t now = lcm_time_now();
+        if (n > 0 || now >= end) {
+            return n;
+        }
+        const uint64_t left = end - now;
+        lcm_farm_await(&f->shared->results, seen,
+            left < LCM_FARM_WAIT_SLICE ? left : LCM_FARM_WAIT_SLICE);
+    }
+}
+
+LCM_API size_t lcm_farm_count(const lcm_Farm* f)
+{
+    return f->count;
+}
+
+LCM_API uint64_t lcm_farm_restarts(const lcm_Farm* f)
+{
+    return f->restarts;
+}
+
+LCM_API size_t lcm_farm_failed(const lcm_Farm* f)
+{
+    return f->failed;
+}
+
+/** Worker side state of batch being processed. */
+typedef struct {
+    lcm_FarmShared* shared;
+    lcm_FarmWorker* w;
+    int responded;
+} lcm_FarmServe;
+
+// Reserves room in response ring, waiting for the parent to make room if
+// necessary.
+static lcm_FarmMessage* lcm_farm_respond(lcm_FarmServe* s, size_t length)
+{
+    const uint32_t ring_size = s->shared->ring_size;
+    for (;;) {
+        const uint32_t seen = LCM_LOAD(&s->w->responses->space.word);
+        lcm_FarmMessage* m = lcm_farm_reserve(
+            s->w->responses, s->w->responses_data, ring_size, length);
+        if (m != NULL) {
+            return m;
+        }
+        lcm_farm_await(&s->w->responses->space, seen, UINT64_MAX);
+    }
+}
+
+static void lcm_farm_send(
+    lcm_FarmServe* s, lcm_FarmMessage* m, uint32_t type, int32_t value)
+{
+    m->type = type;
+    m->value = value;
+    lcm_farm_publish(s->w->responses, m);
+    lcm_farm_notify(&s->shared->results);
+    s->responded = 1;
+}
+
+static void lcm_farm_result(void* context, const lcm_Batch* result)
+{
+    lcm_FarmServe* s = context;
+    const size_t max = s->shared->ring_size - sizeof(lcm_FarmMessage);
+    const size_t length = result->data.length <= max ? result->data.length : 0;
+    lcm_FarmMessage* m = lcm_farm_respond(s, length);
+    m->lambda_id = result->lambda_id;
+    m->batch_id = result->batch_id;
+    memcpy(m + 1, result->data.bytes, length);
+    lcm_farm_send(s, m, LCM_FARM_RESULT,
+        length == result->data.length ? 0 : LCM_ERRFULL);
+}
+
+LCM_API int lcm_farm_serve(lua_State* L, int fd, size_t index)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(lcm_FarmShared)) {
+        return LCM_ERRINIT;
+    }
+    lcm_FarmShared* shared = mmap(
+        NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shared == MAP_FAILED) {
+        return LCM_ERRINIT;
+    }
+    if (shared->magic != LCM_FARM_MAGIC || index >= shared->workers) {
+        munmap(shared, (size_t)st.st_size);
+        return LCM_ERRINIT;
+    }
+    lcm_FarmWorker w;
+    lcm_farm_bind(&w, shared, index, shared->ring_size);
+
+    lcm_FarmServe s = {.shared = shared, .w = &w };
+    const lcm_ClosureBatch c = {.context = &s, .function = lcm_farm_result };
+    for (;;) {
+        const uint32_t seen = LCM_LOAD(&w.requests->data.word);
+        lcm_FarmMessage* m;
+        lcm_FarmMessage h;
+        if (lcm_farm_peek(
+                w.requests, w.requests_data, shared->ring_size, &m, &h)
+            != 0) {
+            munmap(shared, (size_t)st.st_size);
+            return LCM_ERRINIT;
+        }
+        if (m == NULL) {
+            lcm_farm_await(&w.requests->data, seen, UINT64_MAX);
+            continue;
+        }
+        s.responded = 0;
+        if (h.type == LCM_FARM_LAMBDA) {
+            const lcm_Lambda l = {
+                .lambda_id = h.lambda_id,
+                .flags = (uint32_t)h.value,
+                .program = {.lua = (char*)(m + 1), .length = h.length },
+            };
+            const int status = lcm_register(L, l);
+            lcm_FarmMessage* r = lcm_farm_respond(&s, 0);
+            r->lambda_id = l.lambda_id;
+            r->batch_id = 0;
+            lcm_farm_send(&s, r, LCM_FARM_REGISTERED, status);
+        } else if (h.type == LCM_FARM_BATCH) {
+            const lcm_Batch b = {
+                .lambda_id = h.lambda_id,
+                .batch_id = h.batch_id,
+                .encoding = h.value,
+                .data = {.bytes = (uint8_t*)(m + 1), .length = h.length },
+            };
+            const int status = lcm_process(L, b, c);
+
+            // Every batch must be answered, even if it produced no result.
+            if (!s.responded) {
+                lcm_FarmMessage* r = lcm_farm_respond(&s, 0);
+                r->lambda_id = b.lambda_id;
+                r->batch_id = b.batch_id;
+                lcm_farm_send(&s, r, LCM_FARM_RESULT,
+                    status != 0 ? status : LCM_ERRNORESULT);
+            }
+        }
+        lcm_farm_consume(w.requests, &h);
+    }
+}
+
+#else
+
+LCM_API lcm_Farm* lcm_farm_new(
+    const char* path, size_t workers, size_t ring_size, lcm_ClosureFail f)
+{
+    (void)path;
+    (void)workers;
+    (void)ring_size;
+    (void)f;
+    return NULL;
+}
+
+LCM_API void lcm_farm_free(lcm_Farm* f)
+{
+    (void)f;
+}
+
+LCM_API int lcm_farm_register(lcm_Farm* f, const lcm_Lambda l)
+{
+    (void)f;
+    (void)l;
+    return LCM_ERRNOSUPPORT;
+}
+
+LCM_API uint8_t* lcm_farm_alloc(lcm_Farm* f, size_t length)
+{
+    (void)f;
+    (void)length;
+    return NULL;
+}
+
+LCM_API int lcm_farm_submit(
+    lcm_Farm* f, const lcm_Batch b, lcm_ClosureBatch c)
+{
+    (void)f;
+    (void)b;
+    (void)c;
+    return LCM_ERRNOSUPPORT;
+}
+
+LCM_API size_t lcm_farm_poll(lcm_Farm* f)
+{
+    (void)f;
+    return 0;
+}
+
+LCM_API size_t lcm_farm_wait(lcm_Farm* f, uint64_t timeout)
+{
+    (void)f;
+    (void)timeout;
+    return 0;
+}
+
+LCM_API size_t lcm_farm_count(const lcm_Farm* f)
+{
+    (void)f;
+    return 0;
+}
+
+LCM_API uint64_t lcm_farm_restarts(const lcm_Farm* f)
+{
+    (void)f;
+    return 0;
+}
+
+LCM_API size_t lcm_farm_failed(const lcm_Farm* f)
+{
+    (void)f;
+    return 0;
+}
+
+LCM_API int lcm_farm_serve(lua_State* L, int fd, size_t index)
+{
+    (void)L;
+    (void)fd;
+    (void)index;
+    return LCM_ERRNOSUPPORT;
+}
+
+#endif
@@ -0,0 +1,125 @@
+/**
+ * Lua/compute worker farm header.
+ *
+ * A farm runs Lua states in separate worker processes, isolating the parent
+ * process from their crashes and garbage collection pauses. Each worker shares
+ * a memory region with the parent, containing one ring buffer of requests and
+ * one of responses. Batches are written once into the request ring and results
+ * are read directly from the response ring, without any serialization, while
+ * futexes are used to wake up parties waiting for data or space.
+ *
+ * Workers are started by executing a worker program, such as the `lcmworker`
+ * tool, with the file descriptor of the shared memory region and the index of
+ * the worker as arguments. A worker program is expected to call
+ * `lcm_farm_serve()`. Crashed workers are restarted automatically, after which
+ * all lambdas registered with the farm are registered again with the restarted
+ * worker before it is given any batches. Workers writing responses whose
+ * headers do not fit within their response rings are killed and restarted in
+ * the same way, failing their batches in flight with `LCM_ERRCRASH`. A worker
+ * exiting without having responded to any request, such as one whose program
+ * cannot be executed, is restarted after a delay that doubles with every
+ * consecutive such exit, and is given up on after 8 restarts.
+ *
+ * Batches are handed to the worker with the fewest batches in flight, which
+ * means that lambdas must not depend on previous batches having been processed
+ * by the same Lua state.
+ *
+ * Farms are only supported on Linux. Just as Lua states, farms are not thread
+ * safe.
+ *
+ * @file
+ */
+#ifndef lcmfarm_h
+#define lcmfarm_h
+
+#include "lcm.h"
+
+typedef struct lcm_Farm lcm_Farm;
+
+/**
+ * Creates farm of `workers` processes, each started by executing the program
+ * at `path`. Every worker is given rings of `ring_size` bytes, which limits
+ * the size of its batches and results. Batches failing to be processed are
+ * provided to `f`, if it contains a function. Batches lost due to crashes are
+ * provided without data and with status `LCM_ERRCRASH`.
+ *
+ * Returns NULL if memory could not be allocated, shared memory could not be
+ * created, a worker could not be started, or if not running on Linux.
+ */
+LCM_API lcm_Farm* lcm_farm_new(
+    const char* path, size_t workers, size_t ring_size, lcm_ClosureFail f);
+
+/** Terminates all workers and destroys farm. Batches in flight are lost. */
+LCM_API void lcm_farm_free(lcm_Farm* f);
+
+/**
+ * Registers provided lambda with all workers, and waits for them to complete
+ * the registration. Only the ID, flags and program of the lambda are used.
+ *
+ * Workers that have been given up on are skipped.
+ *
+ * Returns `0` (OK), `LCM_ERRMEM`, `LCM_ERRFULL`, `LCM_ERRCRASH`, or any
+ * status returned by `lcm_register()` in a worker. `LCM_ERRCRASH` is also
+ * returned if all workers have been given up on.
+ */
+LCM_API int lcm_farm_register(lcm_Farm* f, const lcm_Lambda l);
+
+/**
+ * Reserves `length` bytes of shared memory for the data of the next batch
+ * submitted. If the data of that batch is written to the reserved memory, it
+ * is handed to its worker without being copied. The reservation is lost if
+ * the farm is polled, or a lambda registered, before the batch is submitted.
+ *
+ * Returns NULL if no worker has room for `length` bytes.
+ */
+LCM_API uint8_t* lcm_farm_alloc(lcm_Farm* f, size_t length);
+
+/**
+ * Submits batch `b` to a worker. Its result is provided to `c` when received
+ * via `lcm_farm_poll()` or `lcm_farm_wait()`, pointing directly into shared
+ * memory. The data of `b` is copied unless it was written to memory returned
+ * by `lcm_farm_alloc()`.
+ *
+ * Returns `0` (OK), `LCM_ERRFULL` if no worker has room for the batch or all
+ * are being restarted, or `LCM_ERRCRASH` if all workers have been given up on.
+ */
+LCM_API int lcm_farm_submit(
+    lcm_Farm* f, const lcm_Batch b, lcm_ClosureBatch c);
+
+/**
+ * Delivers all received results, and restarts any crashed workers.
+ *
+ * Returns the number of batches completed, including failed ones.
+ */
+LCM_API size_t lcm_farm_poll(lcm_Farm* f);
+
+/**
+ * Waits for at most `timeout` nanoseconds for results to become available,
+ * and then polls the farm.
+ *
+ * Returns the number of batches completed, including failed ones.
+ */
+LCM_API size_t lcm_farm_wait(lcm_Farm* f, uint64_t timeout);
+
+/** Returns the number of batches submitted but not yet completed. */
+LCM_API size_t lcm_farm_count(const lcm_Farm* f);
+
+/** Returns the number of times crashed workers have been restarted. */
+LCM_API uint64_t lcm_farm_restarts(const lcm_Farm* f);
+
+/** Returns the number of workers given up on, which are never restarted. */
+LCM_API size_t lcm_farm_failed(const lcm_Farm* f);
+
+/**
+ * Serves requests of the parent process of a worker program, using Lua state
+ * `L`, which must already have been set up using `lcm_openlib()`. `fd` and
+ * `index` are the shared memory file descriptor and worker index given to the
+ * worker program.
+ *
+ * Only returns if the shared memory could not be used, or if it contains an
+ * invalid request, in which case `LCM_ERRINIT` or `LCM_ERRNOSUPPORT` is
+ * returned.
+ */
+LCM_API int lcm_farm_serve(lua_State* L, int fd, size_t index);
+
+#endif
@@ -0,0 +1,102 @@
+#include "lcmjit.h"
+#include <string.h>
+
+// Pushes field `name` of `jit` module, returning `0` if not a function.
+static int lcm_jit_function(lua_State* L, const char* name)
+{
+    lua_getglobal(L, "jit");
+    if (lua_type(L, -1) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    lua_getfield(L, -1, name);
+    lua_remove(L, -2);
+    if (lua_type(L, -1) != LUA_TFUNCTION) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    return 1;
+}
+
+int lcm_jit_available(lua_State* L)
+{
+    if (!lcm_jit_function(L, "attach")) {
+        return 0;
+    }
+    lua_pop(L, 1);
+    return 1;
+}
+
+void lcm_jit_mode(lua_State* L, int index, int mode)
+{
+    if (mode != LCM_JIT_ON && mode != LCM_JIT_OFF) {
+        return;
+    }
+    index = index > 0 ? index : lua_gettop(L) + index + 1;
+    if (!lcm_jit_function(L, mode == LCM_JIT_ON ? "on" : "off")) {
+        return;
+    }
+    lua_pushvalue(L, index);
+    lua_pushboolean(L, 1);
+    if (lua_pcall(L, 2, 0, 0) != 0) {
+        lua_pop(L, 1);
+    }
+}
+
+int lcm_jit_opt(lua_State* L, const char* opt, int hotloop)
+{
+    if (opt == NULL && hotloop <= 0) {
+        return 0;
+    }
+    // Look up `jit.opt.start`, which is not loaded by default.
+    lua_getglobal(L, "require");
+    if (lua_type(L, -1) != LUA_TFUNCTION) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    lua_pushliteral(L, "jit.opt");
+    if (lua_pcall(L, 1, 1, 0) != 0 || lua_type(L, -1) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    lua_getfield(L, -1, "start");
+    lua_remove(L, -2);
+
+    int n = 0;
+    while (opt != NULL && *opt != '\0') {
+        const size_t skip = strspn(opt, " ");
+        const size_t length = strcspn(opt + skip, " ");
+        if (length > 0) {
+            // Leave room for the option and a trailing `hotloop` option.
+            if (!lua_checkstack(L, 2)) {
+                lua_pop(L, n + 1);
+                return LCM_ERRMEM;
+            }
+            lua_pushlstring(L, opt + skip, length);
+            n++;
+        }
+        opt += skip + length;
+    }
+    if (hotloop > 0) {
+        lua_pushfstring(L, "hotloop=%d", hotloop);
+        n++;
+    }
+    if (lua_pcall(L, n, 0, 0) != 0) {
+        lua_pop(L, 1);
+        return LCM_ERRRUN;
+    }
+    return 0;
+}
+
+void lcm_jit_attach(lua_State* L)
+{
+    if (!lcm_jit_function(L, "attach")) {
+        lua_pop(L, 1);
+        return;
+    }
+    lua_insert(L, -2);
+    lua_pushliteral(L, "trace");
+    if (lua_pcall(L, 2, 0, 0) != 0) {
+        lua_pop(L, 1);
+    }
+}
@@ -0,0 +1,40 @@
+/**
+ * Lua/compute LuaJIT control header.
+ *
+ * LuaJIT is controlled via its `jit` Lua module, which is looked up at runtime.
+ * This allows the library to be built against any Lua 5.1 implementation, and
+ * makes all functions in this file do nothing when the `jit` module is missing.
+ *
+ * @file
+ */
+#ifndef lcmjit_h
+#define lcmjit_h
+
+#include "lcm.h"
+
+/** Returns `1` if the LuaJIT `jit` module is loaded in `L`, or `0` if not. */
+int lcm_jit_available(lua_State* L);
+
+/**
+ * Enables or disables JIT compilation of function at stack `index`, and of all
+ * functions it defines, according to `mode`. Compiled code belonging to the
+ * function is flushed.
+ */
+void lcm_jit_mode(lua_State* L, int index, int mode);
+
+/**
+ * Passes each space separated option in `opt`, if not NULL, as well as a
+ * `hotloop` option, if `hotloop` is positive, to `jit.opt.start()`.
+ *
+ * Returns `0` (OK), `LCM_ERRRUN` if LuaJIT rejected any option, or
+ * `LCM_ERRMEM` if the Lua stack cannot hold all options.
+ */
+int lcm_jit_opt(lua_State* L, const char* opt, int hotloop);
+
+/**
+ * Attaches function at top of stack as trace event handler, as if by calling
+ * `jit.attach(f, "trace")`. The function is popped.
+ */
+void lcm_jit_attach(lua_State* L);
+
+#endif
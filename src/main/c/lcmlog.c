@@ -0,0 +1,47 @@
+#include "lcmlog.h"
+#include <string.h>
+
+lcm_LogBuffer* lcm_logbuffer_new(lua_State* L, size_t size)
+{
+    if (size < sizeof(lcm_LogEntry)) {
+        size = sizeof(lcm_LogEntry);
+    }
+    lcm_LogBuffer* b = lua_newuserdata(L, sizeof(lcm_LogBuffer) + size);
+    b->entries = (lcm_LogEntry*)(b + 1);
+    b->entries_count = 0;
+    b->bytes = (char*)b->entries;
+    b->bytes_used = 0;
+    b->bytes_max = size;
+    b->dropped = 0;
+    return b;
+}
+
+int lcm_logbuffer_push(lcm_LogBuffer* b, const lcm_LogEntry* entry)
+{
+    // Entries are stored from the start of the buffer, and message bytes from
+    // its end, making entries share the buffer according to actual lengths.
+    const size_t length = entry->message.length;
+    const size_t used = (b->entries_count + 1) * sizeof(lcm_LogEntry);
+    if (used > b->bytes_max || b->bytes_max - used < b->bytes_used + length) {
+        return 0;
+    }
+    b->bytes_used += length;
+    char* message = memcpy(b->bytes + b->bytes_max - b->bytes_used,
+        entry->message.string, length);
+
+    lcm_LogEntry* e = &b->entries[b->entries_count++];
+    *e = *entry;
+    e->message.string = message;
+    return 1;
+}
+
+void lcm_logbuffer_flush(lcm_LogBuffer* b, lcm_ClosureLogBatch c)
+{
+    if (b->entries_count == 0 && b->dropped == 0) {
+        return;
+    }
+    c.function(c.context, b->entries, b->entries_count, b->dropped);
+    b->entries_count = 0;
+    b->bytes_used = 0;
+    b->dropped = 0;
+}
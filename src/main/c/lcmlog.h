@@ -0,0 +1,47 @@
+/**
+ * Lua/compute log buffer header.
+ *
+ * A log buffer accumulates log entries, and their messages, until they are
+ * delivered in bulk to a `lcm_ClosureLogBatch`. Entries and message bytes are
+ * stored in a single Lua userdata object of fixed size, entries from its start
+ * and message bytes from its end, making the number of entries that fit depend
+ * only on the actual lengths of their messages.
+ *
+ * @file
+ */
+#ifndef lcmlog_h
+#define lcmlog_h
+
+#include "lcm.h"
+
+/** Log buffer. */
+typedef struct {
+    lcm_LogEntry* entries;
+    size_t entries_count;
+    char* bytes;
+    size_t bytes_used, bytes_max;
+    uint64_t dropped;
+} lcm_LogBuffer;
+
+/**
+ * Creates log buffer of `size` bytes, holding both entries and messages, and
+ * pushes it onto the stack of `L`.
+ */
+lcm_LogBuffer* lcm_logbuffer_new(lua_State* L, size_t size);
+
+/**
+ * Copies provided entry, including its message, into buffer.
+ *
+ * Returns `1` on success, or `0` if the buffer lacks room for the entry.
+ */
+int lcm_logbuffer_push(lcm_LogBuffer* b, const lcm_LogEntry* entry);
+
+/**
+ * Delivers all buffered entries, as well as the number of entries dropped
+ * since the last delivery, to closure `c`, and then empties the buffer.
+ *
+ * Nothing is delivered if no entries are buffered or dropped.
+ */
+void lcm_logbuffer_flush(lcm_LogBuffer* b, lcm_ClosureLogBatch c);
+
+#endif
@@ -34,10 +34,32 @@ int lcm_l_register(lua_State* L);
  * This function may be called any amount of times to inform whoever supervises
  * job batch execution about any occurrences of interest.
  *
+ * Calls with a level below the configured log level are ignored. If `message`
+ * is a function, it is only called, to produce the actual message, if the call
+ * is not ignored.
+ *
  * @function log
  * @param lcm LCM context reference.
- * @param message A Lua string, or a number that is converted to a string.
+ * @param message A Lua string, a number that is converted to a string, or a
+ *                function returning either.
+ * @param level Optional log level, such as `lcm.WARN`. Defaults to `lcm.INFO`.
  */
 int lcm_l_log(lua_State* L);
 
+/**
+ * Declares state of lambda being registered.
+ *
+ * The provided table is written to checkpoints produced by `lcm_checkpoint()`,
+ * and is updated in place when a checkpoint is restored using `lcm_restore()`.
+ * It may only contain booleans, numbers, strings and tables of such values.
+ * Lambdas keeping state across batches should keep it all in this table, and
+ * keep a reference to it, rather than in globals or other upvalues.
+ *
+ * @function state
+ * @param lcm LCM context reference.
+ * @param state Table holding the state of the lambda.
+ * @return The provided table.
+ */
+int lcm_l_state(lua_State* L);
+
 #endif
@@ -0,0 +1,165 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "lcmperf.h"
+
+#ifdef __linux__
+#include "lauxlib.h"
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define LCM_PERF_METATYPE "LCM.perf"
+
+/** Counted hardware events, in the order of `lcm_PerfStats` fields. */
+static const uint64_t lcm_perf_events[LCM_PERF_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+/** Flags of counted hardware events, in the order of `lcm_perf_events`. */
+static const uint32_t lcm_perf_flags[LCM_PERF_COUNTERS] = {
+    LCM_PERF_FCYCLES,
+    LCM_PERF_FINSTRUCTIONS,
+    LCM_PERF_FLLCMISSES,
+    LCM_PERF_FBRANCHMISSES,
+};
+
+// Opens counter of calling thread, adding it to `group` if not -1.
+static int lcm_perf_open(uint64_t event, int group)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = event;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+        | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// Closes counters of object at stack index 1.
+static int lcm_perf_gc(lua_State* L)
+{
+    lcm_Perf* p = luaL_checkudata(L, 1, LCM_PERF_METATYPE);
+    for (size_t i = 0; i < LCM_PERF_COUNTERS; ++i) {
+        if (p->fds[i] >= 0) {
+            close(p->fds[i]);
+            p->fds[i] = -1;
+        }
+    }
+    return 0;
+}
+
+// Reads all counters, with counters missing from the group read as zero,
+// and the times the group has been enabled and running, in that order, into
+// the two slots following the counters.
+static void lcm_perf_read(const lcm_Perf* p, uint64_t* values)
+{
+    uint64_t group[3 + LCM_PERF_COUNTERS];
+    const ssize_t n = read(p->fds[0], group, sizeof(group));
+    const int valid = n >= (ssize_t)(3 * sizeof(uint64_t));
+    for (size_t i = 0; i < LCM_PERF_COUNTERS; ++i) {
+        const int slot = p->slots[i];
+        values[i] = valid && slot >= 0 && (uint64_t)slot < group[0]
+            ? group[3 + slot]
+            : 0;
+    }
+    values[LCM_PERF_COUNTERS] = valid ? group[1] : 0;
+    values[LCM_PERF_COUNTERS + 1] = valid ? group[2] : 0;
+}
+
+lcm_Perf* lcm_perf_new(lua_State* L)
+{
+    // Create object before opening counters, making sure they are closed
+    // whenever the object is collected.
+    lcm_Perf* p = lua_newuserdata(L, sizeof(lcm_Perf));
+    for (size_t i = 0; i < LCM_PERF_COUNTERS; ++i) {
+        p->fds[i] = -1;
+        p->slots[i] = -1;
+    }
+    p->available = 0;
+    memset(p->start, 0, sizeof(p->start));
+    if (luaL_newmetatable(L, LCM_PERF_METATYPE)) {
+        lua_pushcfunction(L, lcm_perf_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+
+    int count = 0;
+    for (size_t i = 0; i < LCM_PERF_COUNTERS; ++i) {
+        p->fds[i] = lcm_perf_open(lcm_perf_events[i], i == 0 ? -1 : p->fds[0]);
+        if (p->fds[i] >= 0) {
+            p->slots[i] = count++;
+            p->available |= lcm_perf_flags[i];
+        } else if (i == 0) {
+            lua_pop(L, 1);
+            return NULL;
+        }
+    }
+    return p;
+}
+
+void lcm_perf_begin(lcm_Perf* p)
+{
+    lcm_perf_read(p, p->start);
+}
+
+void lcm_perf_end(lcm_Perf* p, lcm_PerfStats* s)
+{
+    uint64_t end[LCM_PERF_COUNTERS + 2];
+    lcm_perf_read(p, end);
+
+    // If other counters competed for the hardware, the group only counted
+    // during part of the time it was enabled, and its counts are scaled up
+    // to estimate those of the whole time.
+    uint64_t delta[LCM_PERF_COUNTERS + 2];
+    for (size_t i = 0; i < LCM_PERF_COUNTERS + 2; ++i) {
+        delta[i] = end[i] >= p->start[i] ? end[i] - p->start[i] : 0;
+    }
+    const uint64_t enabled = delta[LCM_PERF_COUNTERS];
+    const uint64_t running = delta[LCM_PERF_COUNTERS + 1];
+    if (running == 0) {
+        // Nothing was counted, which would make the call seem free.
+        s->unmeasured += 1;
+        return;
+    }
+    if (running < enabled) {
+        const double scale = (double)enabled / (double)running;
+        for (size_t i = 0; i < LCM_PERF_COUNTERS; ++i) {
+            delta[i] = (uint64_t)((double)delta[i] * scale);
+        }
+    }
+    s->calls += 1;
+    s->cycles += delta[0];
+    s->instructions += delta[1];
+    s->llc_misses += delta[2];
+    s->branch_misses += delta[3];
+}
+
+#else
+
+lcm_Perf* lcm_perf_new(lua_State* L)
+{
+    (void)L;
+    return NULL;
+}
+
+void lcm_perf_begin(lcm_Perf* p)
+{
+    (void)p;
+}
+
+void lcm_perf_end(lcm_Perf* p, lcm_PerfStats* s)
+{
+    (void)p;
+    (void)s;
+}
+
+#endif
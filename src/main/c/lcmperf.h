@@ -0,0 +1,55 @@
+/**
+ * Lua/compute hardware performance counter header.
+ *
+ * Counts CPU cycles, retired instructions, last level cache misses and branch
+ * misses using Linux `perf_event_open()`. The counters are opened as a single
+ * group, making them all count during the same intervals, and are read before
+ * and after every measured lambda call. Only user space execution of the
+ * thread opening the counters is counted.
+ *
+ * Counters not supported by the CPU, or not permitted by the kernel, are left
+ * out of the group and always read as zero, and the flags of those opened are
+ * kept. If the cycle counter cannot be opened, no counters are available at
+ * all. If the group is multiplexed with
+ * other counters, and only counts during part of a call, its counts are
+ * scaled by how long it was enabled relative to how long it was counting.
+ *
+ * @file
+ */
+#ifndef lcmperf_h
+#define lcmperf_h
+
+#include "lcm.h"
+
+/** Number of counters in a counter group. */
+#define LCM_PERF_COUNTERS 4
+
+/** Hardware counter group. */
+typedef struct {
+    int fds[LCM_PERF_COUNTERS];
+    int slots[LCM_PERF_COUNTERS];
+    uint32_t available; ///< `LCM_PERF_F*` flags of opened counters.
+    uint64_t start[LCM_PERF_COUNTERS + 2]; ///< Counters, enabled and running.
+} lcm_Perf;
+
+/**
+ * Opens counters of calling thread and pushes object owning them onto the
+ * stack of `L`. The counters are closed when the object is garbage collected.
+ *
+ * Returns NULL, and pushes nothing, if no counters could be opened or if not
+ * running on Linux.
+ */
+lcm_Perf* lcm_perf_new(lua_State* L);
+
+/** Reads current counter values, to be compared by `lcm_perf_end()`. */
+void lcm_perf_begin(lcm_Perf* p);
+
+/**
+ * Reads current counter values and adds how much they increased since the
+ * last call to `lcm_perf_begin()` to `s`, which also has its call counter
+ * incremented. If the counters never ran in between, only the unmeasured call
+ * counter of `s` is incremented.
+ */
+void lcm_perf_end(lcm_Perf* p, lcm_PerfStats* s);
+
+#endif
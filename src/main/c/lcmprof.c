@@ -0,0 +1,222 @@
+#include "lcmprof.h"
+#include "lauxlib.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// The address of this variable is used as registry key of the profiler state.
+static const char lcm_profile_key = 0;
+
+static lcm_Profile* lcm_profile_get(lua_State* L)
+{
+    lua_pushlightuserdata(L, (void*)&lcm_profile_key);
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    lcm_Profile* p = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return p;
+}
+
+static void lcm_profile_count(
+    lcm_Profile* p, const char* stack, size_t length, uint64_t samples)
+{
+    // FNV-1a.
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ (uint8_t)stack[i]) * UINT64_C(1099511628211);
+    }
+    size_t i = hash % LCM_PROFILE_CAPACITY;
+    for (size_t n = 0; n < LCM_PROFILE_CAPACITY; ++n) {
+        lcm_ProfileEntry* entry = &p->entries[i];
+        if (entry->samples == 0) {
+            // Leave some slots free to keep probe sequences short.
+            if (p->count >= LCM_PROFILE_CAPACITY / 4 * 3) {
+                break;
+            }
+            p->count++;
+            entry->hash = hash;
+            entry->samples = samples;
+            memcpy(entry->stack, stack, length);
+            entry->stack[length] = '\0';
+            return;
+        }
+        if (entry->hash == hash && strncmp(entry->stack, stack, length) == 0
+            && entry->stack[length] == '\0') {
+            entry->samples += samples;
+            return;
+        }
+        i = (i + 1) % LCM_PROFILE_CAPACITY;
+    }
+    p->dropped += samples;
+}
+
+// Writes root of stack sampled now, returning its length.
+static size_t lcm_profile_root(const lcm_Profile* p, char* stack)
+{
+    const int n = *p->active
+        ? snprintf(stack, LCM_PROFILE_STACK_MAX, "lambda:%" PRId32,
+              *p->lambda_id)
+        : snprintf(stack, LCM_PROFILE_STACK_MAX, "%s", LCM_PROFILE_OUTSIDE);
+    return n < 0 ? 0 : MIN((size_t)n, LCM_PROFILE_STACK_MAX - 1);
+}
+
+// Appends formatted frame to stack, returning new stack length.
+static size_t lcm_profile_append(
+    char* stack, size_t length, const char* source, int line)
+{
+    const size_t available = LCM_PROFILE_STACK_MAX - length;
+    const int n = line >= 0
+        ? snprintf(stack + length, available, ";%s:%d", source, line)
+        : snprintf(stack + length, available, ";%s", source);
+    return n < 0 ? length : MIN(length + (size_t)n, LCM_PROFILE_STACK_MAX - 1);
+}
+
+static void lcm_profile_hook(lua_State* L, lua_Debug* ar)
+{
+    (void)ar;
+
+    lcm_Profile* p = lcm_profile_get(L);
+    if (p == NULL) {
+        return;
+    }
+    lua_Debug frames[LCM_PROFILE_DEPTH];
+    int depth = 0;
+    while (depth < LCM_PROFILE_DEPTH
+        && lua_getstack(L, depth, &frames[depth])) {
+        lua_getinfo(L, "Sl", &frames[depth]);
+        depth++;
+    }
+    char stack[LCM_PROFILE_STACK_MAX];
+    size_t length = lcm_profile_root(p, stack);
+    for (int i = depth - 1; i >= 0; --i) {
+        length = lcm_profile_append(
+            stack, length, frames[i].short_src, frames[i].currentline);
+    }
+    lcm_profile_count(p, stack, length, 1);
+}
+
+// Called by `jit.profile` with arguments [thread, samples, vmstate].
+static int lcm_profile_jitsample(lua_State* L)
+{
+    lcm_Profile* p = lcm_profile_get(L);
+    if (p == NULL) {
+        return 0;
+    }
+    // Call `jit.profile.dumpstack(thread, "pl;", -depth)`.
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_pushvalue(L, 1);
+    lua_pushliteral(L, "pl;");
+    lua_pushinteger(L, -LCM_PROFILE_DEPTH);
+    lua_call(L, 3, 1);
+
+    size_t dump_length;
+    const char* dump = lua_tolstring(L, -1, &dump_length);
+    while (dump_length > 0 && dump[dump_length - 1] == ';') {
+        dump_length--;
+    }
+    char stack[LCM_PROFILE_STACK_MAX];
+    const size_t root = lcm_profile_root(p, stack);
+    const int n = snprintf(stack + root, sizeof(stack) - root, ";%.*s",
+        (int)dump_length, dump);
+    const size_t length
+        = n < 0 ? root : MIN(root + (size_t)n, sizeof(stack) - 1);
+    lcm_profile_count(p, stack, length, (uint64_t)lua_tointeger(L, 2));
+    return 0;
+}
+
+// Pushes `jit.profile` module and returns 1, or pushes nothing and returns 0.
+static int lcm_profile_require(lua_State* L)
+{
+    lua_getglobal(L, "require");
+    if (lua_type(L, -1) != LUA_TFUNCTION) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    lua_pushliteral(L, "jit.profile");
+    if (lua_pcall(L, 1, 1, 0) != 0 || lua_type(L, -1) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    return 1;
+}
+
+void lcm_profile_start(
+    lua_State* L, const int32_t* lambda_id, const int* active, int interval)
+{
+    lcm_profile_stop(L, (lcm_ClosureWrite){.function = NULL });
+
+    // Create profiler state and save it to registry.
+    lcm_Profile* p = lua_newuserdata(L, sizeof(lcm_Profile));
+    memset(p, 0, sizeof(lcm_Profile));
+    p->lambda_id = lambda_id;
+    p->active = active;
+    lua_pushlightuserdata(L, (void*)&lcm_profile_key);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+    lua_pop(L, 1);
+
+    // Prefer `jit.profile`, if available.
+    if (lcm_profile_require(L)) {
+        lua_getfield(L, -1, "start");
+        lua_pushfstring(L, "li%d", interval > 0 ? interval : 1);
+        lua_getfield(L, -3, "dumpstack");
+        lua_pushcclosure(L, lcm_profile_jitsample, 1);
+        p->jit = lua_pcall(L, 2, 0, 0) == 0;
+        lua_pop(L, p->jit ? 1 : 2); // Pop module and any error message.
+    }
+    if (!p->jit) {
+        lua_sethook(L, lcm_profile_hook, LUA_MASKCOUNT,
+            interval > 0 ? interval : 1000);
+    }
+}
+
+int lcm_profile_stop(lua_State* L, lcm_ClosureWrite w)
+{
+    lcm_Profile* p = lcm_profile_get(L);
+    if (p == NULL) {
+        return 0;
+    }
+    // Stop taking samples.
+    if (p->jit) {
+        if (lcm_profile_require(L)) {
+            lua_getfield(L, -1, "stop");
+            lua_pcall(L, 0, 0, 0);
+            lua_pop(L, 1);
+        }
+    } else {
+        lua_sethook(L, NULL, 0, 0);
+    }
+    // Write collected samples.
+    int status = 0;
+    if (w.function != NULL) {
+        char line[LCM_PROFILE_STACK_MAX + 32];
+        for (size_t i = 0; i < LCM_PROFILE_CAPACITY; ++i) {
+            const lcm_ProfileEntry* entry = &p->entries[i];
+            if (entry->samples == 0) {
+                continue;
+            }
+            const int n = snprintf(line, sizeof(line), "%s %" PRIu64 "\n",
+                entry->stack, entry->samples);
+            if (w.function(w.context, line, (size_t)n) != 0) {
+                status = LCM_ERRIO;
+                goto end;
+            }
+        }
+        if (p->dropped > 0) {
+            const int n = snprintf(
+                line, sizeof(line), "[dropped] %" PRIu64 "\n", p->dropped);
+            if (w.function(w.context, line, (size_t)n) != 0) {
+                status = LCM_ERRIO;
+                goto end;
+            }
+        }
+    }
+
+end:
+    // Release profiler state.
+    lua_pushlightuserdata(L, (void*)&lcm_profile_key);
+    lua_pushnil(L);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+    return status;
+}
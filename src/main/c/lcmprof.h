@@ -0,0 +1,69 @@
+/**
+ * Lua/compute sampling profiler header.
+ *
+ * The profiler periodically samples the Lua call stack, and counts how many
+ * times each distinct stack is seen. Every stack is prefixed with the ID of the
+ * lambda active when the sample was taken, or with `[outside]` if no lambda
+ * was active. On LuaJIT 2.1, the `jit.profile`
+ * module is used to take samples. On other Lua implementations a count hook is
+ * used instead.
+ *
+ * @file
+ */
+#ifndef lcmprof_h
+#define lcmprof_h
+
+#include "lcm.h"
+
+/** Root of stacks sampled while no lambda is active. */
+#define LCM_PROFILE_OUTSIDE "[outside]"
+
+/** Maximum number of bytes in any collapsed stack, including lambda ID. */
+#define LCM_PROFILE_STACK_MAX 512
+
+/** Maximum number of distinct stacks recorded by the profiler. */
+#define LCM_PROFILE_CAPACITY 1024
+
+/** Maximum number of stack frames walked when using the count hook. */
+#define LCM_PROFILE_DEPTH 32
+
+/** Profiler sample counter. */
+typedef struct {
+    uint64_t hash;
+    uint64_t samples;
+    char stack[LCM_PROFILE_STACK_MAX];
+} lcm_ProfileEntry;
+
+/** Profiler state. */
+typedef struct {
+    const int32_t* lambda_id;
+    const int* active;
+    int jit;
+    size_t count;
+    uint64_t dropped;
+    lcm_ProfileEntry entries[LCM_PROFILE_CAPACITY];
+} lcm_Profile;
+
+/**
+ * Starts profiling of `L`, attributing samples to the lambda ID pointed to by
+ * `lambda_id` at the time each sample is taken, unless `active` then points to
+ * `0`.
+ *
+ * `interval` is given in milliseconds when `jit.profile` is used, and in Lua
+ * VM instructions when the count hook is used.
+ *
+ * Any already running profiling session is stopped and its samples discarded.
+ */
+void lcm_profile_start(
+    lua_State* L, const int32_t* lambda_id, const int* active, int interval);
+
+/**
+ * Stops profiling of `L` and writes all samples to `w`, in the collapsed
+ * stack format consumed by `flamegraph.pl` and similar tools.
+ *
+ * Returns `0` (OK) or `LCM_ERRIO`. Nothing is written if the profiler was not
+ * running.
+ */
+int lcm_profile_stop(lua_State* L, lcm_ClosureWrite w);
+
+#endif
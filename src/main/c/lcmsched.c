@@ -0,0 +1,317 @@
+#include "lcmsched.h"
+#include "lcmtime.h"
+#include <stdlib.h>
+
+/** Queued batch. */
+typedef struct {
+    lcm_Batch batch;
+    lcm_ClosureBatch closure;
+    int priority;
+    uint64_t deadline;
+    uint64_t tag;
+    uint64_t sequence;
+    uint64_t submitted;
+} lcm_SchedEntry;
+
+/** Weighted fair queuing weight of a lambda. */
+typedef struct {
+    int32_t lambda_id;
+    uint32_t weight;
+} lcm_SchedWeight;
+
+/** Weighted fair queuing state of a lambda within a priority class. */
+typedef struct {
+    int32_t lambda_id;
+    int priority;
+    uint64_t finish;
+} lcm_SchedFlow;
+
+/**
+ * Priority class, whose virtual time is the finish tag of the batch without
+ * deadline last taken out of its queue.
+ */
+typedef struct {
+    int priority;
+    uint64_t vtime;
+} lcm_SchedClass;
+
+struct lcm_Scheduler {
+    lcm_ClosureReport closure_report;
+    lcm_SchedEntry* heap;
+    size_t count, capacity;
+    lcm_SchedWeight* weights;
+    size_t weights_count, weights_capacity;
+    lcm_SchedFlow* flows;
+    size_t flows_count, flows_capacity;
+    lcm_SchedClass* classes;
+    size_t classes_count, classes_capacity;
+    uint64_t sequence;
+};
+
+LCM_API lcm_Scheduler* lcm_sched_new(size_t capacity, lcm_ClosureReport r)
+{
+    lcm_Scheduler* s = malloc(sizeof(lcm_Scheduler));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->heap = malloc(capacity * sizeof(lcm_SchedEntry));
+    if (s->heap == NULL && capacity > 0) {
+        free(s);
+        return NULL;
+    }
+    s->closure_report = r;
+    s->count = 0;
+    s->capacity = capacity;
+    s->weights = NULL;
+    s->weights_count = 0;
+    s->weights_capacity = 0;
+    s->flows = NULL;
+    s->flows_count = 0;
+    s->flows_capacity = 0;
+    s->classes = NULL;
+    s->classes_count = 0;
+    s->classes_capacity = 0;
+    s->sequence = 0;
+    return s;
+}
+
+LCM_API void lcm_sched_free(lcm_Scheduler* s)
+{
+    if (s != NULL) {
+        free(s->heap);
+        free(s->weights);
+        free(s->flows);
+        free(s->classes);
+        free(s);
+    }
+}
+
+// Makes room for one more item in array `items`, holding `count` items of
+// `size` bytes each. Returns the array, which may have been moved, or NULL if
+// memory could not be allocated.
+static void* lcm_sched_grow(
+    void* items, size_t count, size_t* capacity, size_t size)
+{
+    if (count < *capacity) {
+        return items;
+    }
+    const size_t c = *capacity > 0 ? *capacity * 2 : 8;
+    void* grown = realloc(items, c * size);
+    if (grown != NULL) {
+        *capacity = c;
+    }
+    return grown;
+}
+
+// Returns weight of identified lambda.
+static uint32_t lcm_sched_weightof(const lcm_Scheduler* s, int32_t lambda_id)
+{
+    for (size_t i = 0; i < s->weights_count; ++i) {
+        if (s->weights[i].lambda_id == lambda_id) {
+            return s->weights[i].weight;
+        }
+    }
+    return 1;
+}
+
+// Returns flow of identified lambda in priority class, creating it if missing.
+static lcm_SchedFlow* lcm_sched_flow(
+    lcm_Scheduler* s, int32_t lambda_id, int priority)
+{
+    for (size_t i = 0; i < s->flows_count; ++i) {
+        if (s->flows[i].lambda_id == lambda_id
+            && s->flows[i].priority == priority) {
+            return &s->flows[i];
+        }
+    }
+    lcm_SchedFlow* flows = lcm_sched_grow(
+        s->flows, s->flows_count, &s->flows_capacity, sizeof(lcm_SchedFlow));
+    if (flows == NULL) {
+        return NULL;
+    }
+    s->flows = flows;
+    lcm_SchedFlow* flow = &s->flows[s->flows_count++];
+    flow->lambda_id = lambda_id;
+    flow->priority = priority;
+    flow->finish = 0;
+    return flow;
+}
+
+// Returns identified priority class, creating it if missing.
+static lcm_SchedClass* lcm_sched_class(lcm_Scheduler* s, int priority)
+{
+    for (size_t i = 0; i < s->classes_count; ++i) {
+        if (s->classes[i].priority == priority) {
+            return &s->classes[i];
+        }
+    }
+    lcm_SchedClass* classes = lcm_sched_grow(s->classes, s->classes_count,
+        &s->classes_capacity, sizeof(lcm_SchedClass));
+    if (classes == NULL) {
+        return NULL;
+    }
+    s->classes = classes;
+    lcm_SchedClass* pclass = &s->classes[s->classes_count++];
+    pclass->priority = priority;
+    pclass->vtime = 0;
+    return pclass;
+}
+
+LCM_API int lcm_sched_weight(
+    lcm_Scheduler* s, int32_t lambda_id, uint32_t weight)
+{
+    weight = weight > 0 ? weight : 1;
+    for (size_t i = 0; i < s->weights_count; ++i) {
+        if (s->weights[i].lambda_id == lambda_id) {
+            s->weights[i].weight = weight;
+            return 0;
+        }
+    }
+    lcm_SchedWeight* weights = lcm_sched_grow(s->weights, s->weights_count,
+        &s->weights_capacity, sizeof(lcm_SchedWeight));
+    if (weights == NULL) {
+        return LCM_ERRMEM;
+    }
+    s->weights = weights;
+    s->weights[s->weights_count++] = (lcm_SchedWeight){
+        .lambda_id = lambda_id,
+        .weight = weight,
+    };
+    return 0;
+}
+
+// Returns non-zero if entry `a` is to be processed before entry `b`.
+static int lcm_sched_before(const lcm_SchedEntry* a, const lcm_SchedEntry* b)
+{
+    if (a->priority != b->priority) {
+        return a->priority < b->priority;
+    }
+    const uint64_t a_deadline = a->deadline != 0 ? a->deadline : UINT64_MAX;
+    const uint64_t b_deadline = b->deadline != 0 ? b->deadline : UINT64_MAX;
+    if (a_deadline != b_deadline) {
+        return a_deadline < b_deadline;
+    }
+    if (a->tag != b->tag) {
+        return a->tag < b->tag;
+    }
+    return a->sequence < b->sequence;
+}
+
+static void lcm_sched_swap(lcm_SchedEntry* a, lcm_SchedEntry* b)
+{
+    const lcm_SchedEntry tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+LCM_API int lcm_sched_submit(lcm_Scheduler* s, const lcm_Batch b,
+    int priority, uint64_t deadline, lcm_ClosureBatch c)
+{
+    if (s->count == s->capacity) {
+        return LCM_ERRFULL;
+    }
+    // Batches with deadlines are ordered by deadline alone, and are not
+    // given finish tags. Other batches are given finish tags of their lambda
+    // within their class, using batch data length as cost estimate, scaled by
+    // lambda weight.
+    uint64_t tag = 0;
+    if (deadline == 0) {
+        lcm_SchedFlow* flow = lcm_sched_flow(s, b.lambda_id, priority);
+        lcm_SchedClass* pclass = lcm_sched_class(s, priority);
+        if (flow == NULL || pclass == NULL) {
+            return LCM_ERRMEM;
+        }
+        const uint64_t start
+            = flow->finish > pclass->vtime ? flow->finish : pclass->vtime;
+        flow->finish = start
+            + (((uint64_t)b.data.length + 1) << 16)
+                / lcm_sched_weightof(s, b.lambda_id);
+        tag = flow->finish;
+    }
+    const uint64_t now = lcm_time_now();
+
+    size_t i = s->count++;
+    s->heap[i] = (lcm_SchedEntry){
+        .batch = b,
+        .closure = c,
+        .priority = priority,
+        .deadline = deadline != 0 ? now + deadline : 0,
+        .tag = tag,
+        .sequence = s->sequence++,
+        .submitted = now,
+    };
+    // Sift up.
+    while (i > 0) {
+        const size_t parent = (i - 1) / 2;
+        if (!lcm_sched_before(&s->heap[i], &s->heap[parent])) {
+            break;
+        }
+        lcm_sched_swap(&s->heap[i], &s->heap[parent]);
+        i = parent;
+    }
+    return 0;
+}
+
+// Removes first entry in queue and returns it.
+static lcm_SchedEntry lcm_sched_pop(lcm_Scheduler* s)
+{
+    const lcm_SchedEntry first = s->heap[0];
+    s->heap[0] = s->heap[--s->count];
+
+    // Sift down.
+    size_t i = 0;
+    for (;;) {
+        const size_t left = i * 2 + 1, right = left + 1;
+        size_t next = i;
+        if (left < s->count
+            && lcm_sched_before(&s->heap[left], &s->heap[next])) {
+            next = left;
+        }
+        if (right < s->count
+            && lcm_sched_before(&s->heap[right], &s->heap[next])) {
+            next = right;
+        }
+        if (next == i) {
+            break;
+        }
+        lcm_sched_swap(&s->heap[i], &s->heap[next]);
+        i = next;
+    }
+    return first;
+}
+
+LCM_API size_t lcm_sched_run(lcm_Scheduler* s, lua_State* L, size_t max)
+{
+    size_t n = 0;
+    for (; n < max && s->count > 0; ++n) {
+        const lcm_SchedEntry e = lcm_sched_pop(s);
+        if (e.tag != 0) {
+            lcm_SchedClass* pclass = lcm_sched_class(s, e.priority);
+            if (pclass != NULL && pclass->vtime < e.tag) {
+                pclass->vtime = e.tag;
+            }
+        }
+        lcm_SchedReport report = {
+            .lambda_id = e.batch.lambda_id,
+            .batch_id = e.batch.batch_id,
+            .priority = e.priority,
+        };
+        const uint64_t start = lcm_time_now();
+        report.queue_time = start - e.submitted;
+        if (e.deadline != 0 && start > e.deadline) {
+            report.status = LCM_ERREXPIRED;
+        } else {
+            report.status = lcm_process(L, e.batch, e.closure);
+            report.exec_time = lcm_time_now() - start;
+        }
+        if (s->closure_report.function != NULL) {
+            s->closure_report.function(s->closure_report.context, &report);
+        }
+    }
+    return n;
+}
+
+LCM_API size_t lcm_sched_count(const lcm_Scheduler* s)
+{
+    return s->count;
+}
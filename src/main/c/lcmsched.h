@@ -0,0 +1,112 @@
+/**
+ * Lua/compute batch scheduler header.
+ *
+ * A scheduler queues batches until they are processed, one at a time, using
+ * `lcm_process()`. Queued batches are ordered first by priority class, then by
+ * deadline, with the earliest deadline first. Batches without deadlines come
+ * last in their class, and are ordered using weighted fair queuing, which
+ * divides processing within each class between lambda IDs in proportion to
+ * their weights. Each class keeps its own virtual time, which means that
+ * batches queued in one class never affect the share of a lambda in another.
+ *
+ * Batches whose deadlines have passed when they are about to be processed are
+ * dropped and reported as failed with `LCM_ERREXPIRED`.
+ *
+ * Just as Lua states, schedulers are not thread safe.
+ *
+ * @file
+ */
+#ifndef lcmsched_h
+#define lcmsched_h
+
+#include "lcm.h"
+
+///{ Standard priority classes. Lower values are scheduled first.
+#define LCM_PRIORITY_INTERACTIVE 0
+#define LCM_PRIORITY_NORMAL 10
+#define LCM_PRIORITY_BULK 20
+///}
+
+typedef struct lcm_Scheduler lcm_Scheduler;
+typedef struct lcm_SchedReport lcm_SchedReport;
+
+/**
+ * Function used to receive reports about processed or dropped batches.
+ *
+ * Provided `report` is only guaranteed to point to valid memory during the
+ * invocation of the function.
+ */
+typedef void (*lcm_FunctionReport)(
+    void* context, const lcm_SchedReport* report);
+
+/**
+ * Closure holding some arbitrary context pointer and a function for receiving
+ * scheduler reports.
+ *
+ * When `function` is called, the `context` should be provided as argument.
+ */
+typedef struct lcm_ClosureReport {
+    void* context;
+    lcm_FunctionReport function;
+} lcm_ClosureReport;
+
+/**
+ * Scheduler report.
+ *
+ * Produced for each batch leaving a scheduler queue. Times are given in
+ * nanoseconds. `queue_time` is the time from submission until processing
+ * started, or until the batch was dropped. `exec_time` is the time spent in
+ * `lcm_process()`, which is `0` for dropped batches.
+ */
+struct lcm_SchedReport {
+    int32_t lambda_id, batch_id;
+    int priority;
+    int status;
+    uint64_t queue_time, exec_time;
+};
+
+/**
+ * Creates scheduler able to hold up to `capacity` queued batches.
+ *
+ * If `r` contains a function, it is called once for every batch leaving the
+ * queue. Returns NULL if memory could not be allocated.
+ */
+LCM_API lcm_Scheduler* lcm_sched_new(size_t capacity, lcm_ClosureReport r);
+
+/** Destroys scheduler. Any queued batches are discarded without reports. */
+LCM_API void lcm_sched_free(lcm_Scheduler* s);
+
+/**
+ * Sets weighted fair queuing weight of identified lambda. The default weight
+ * of every lambda is `1`.
+ *
+ * Returns `0` (OK) or `LCM_ERRMEM`.
+ */
+LCM_API int lcm_sched_weight(
+    lcm_Scheduler* s, int32_t lambda_id, uint32_t weight);
+
+/**
+ * Queues batch `b` for being processed with priority class `priority`.
+ *
+ * If `deadline` is not `0`, the batch is dropped unless processing starts
+ * within `deadline` nanoseconds from now. The memory referenced by `b` must
+ * remain valid until the batch leaves the queue. Results are provided to `c`,
+ * as with `lcm_process()`.
+ *
+ * Returns `0` (OK), `LCM_ERRFULL` or `LCM_ERRMEM`.
+ */
+LCM_API int lcm_sched_submit(lcm_Scheduler* s, const lcm_Batch b,
+    int priority, uint64_t deadline, lcm_ClosureBatch c);
+
+/**
+ * Processes, using referenced Lua state, up to `max` queued batches in
+ * scheduling order.
+ *
+ * Returns the number of batches that left the queue, including dropped ones.
+ */
+LCM_API size_t lcm_sched_run(lcm_Scheduler* s, lua_State* L, size_t max);
+
+/** Returns number of batches currently queued in scheduler. */
+LCM_API size_t lcm_sched_count(const lcm_Scheduler* s);
+
+#endif
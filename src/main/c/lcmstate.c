@@ -0,0 +1,656 @@
+#include "lcmstate.h"
+#include "lauxlib.h"
+#include <math.h>
+#include <string.h>
+
+#define LCM_STATE_MAGIC "LCMK"
+#define LCM_STATE_VERSION 2
+
+// Size of read and write buffers, in bytes.
+#define LCM_STATE_BUFFER_SIZE 4096
+
+// Converts relative stack index into an absolute one.
+#define ABSINDEX(L, i) ((i) > 0 ? (i) : lua_gettop(L) + (i) + 1)
+
+///{ Value and record tags.
+#define LCM_STATE_TFALSE 1
+#define LCM_STATE_TTRUE 2
+#define LCM_STATE_TINTEGER 3 ///< Zigzag varint.
+#define LCM_STATE_TNUMBER 4 ///< Little-endian IEEE 754 double.
+#define LCM_STATE_TSTRING 5 ///< Varint length and bytes.
+#define LCM_STATE_TTABLE 6 ///< Key/value pairs, until end tag.
+#define LCM_STATE_TEND 7
+#define LCM_STATE_TLAMBDA 8 ///< Lambda record.
+#define LCM_STATE_TSET 9 ///< Path of changed key and its new value.
+#define LCM_STATE_TDEL 10 ///< Path of removed key.
+///}
+
+typedef struct {
+    lcm_ClosureWrite w;
+    int status;
+    size_t length;
+    uint8_t bytes[LCM_STATE_BUFFER_SIZE];
+} lcm_StateWriter;
+
+typedef struct {
+    lcm_ClosureRead r;
+    int status;
+    size_t offset, length;
+    uint8_t bytes[LCM_STATE_BUFFER_SIZE];
+} lcm_StateReader;
+
+/**
+ * Delta being written for the state table of a lambda. The stack indexes of
+ * the keys leading from the state table to the table being compared with its
+ * copy are kept in `keys`.
+ */
+typedef struct {
+    int32_t lambda_id;
+    int changed;
+    int depth;
+    int keys[LCM_STATE_DEPTH];
+} lcm_StateDelta;
+
+static void lcm_state_flush(lcm_StateWriter* wr)
+{
+    if (wr->status == 0 && wr->length > 0
+        && wr->w.function(wr->w.context, wr->bytes, wr->length) != 0) {
+        wr->status = LCM_ERRIO;
+    }
+    wr->length = 0;
+}
+
+static void lcm_state_put(lcm_StateWriter* wr, const void* data, size_t length)
+{
+    if (length > sizeof(wr->bytes) - wr->length) {
+        lcm_state_flush(wr);
+        if (length > sizeof(wr->bytes)) {
+            if (wr->status == 0
+                && wr->w.function(wr->w.context, data, length) != 0) {
+                wr->status = LCM_ERRIO;
+            }
+            return;
+        }
+    }
+    memcpy(&wr->bytes[wr->length], data, length);
+    wr->length += length;
+}
+
+static void lcm_state_putbyte(lcm_StateWriter* wr, uint8_t byte)
+{
+    lcm_state_put(wr, &byte, 1);
+}
+
+static void lcm_state_putvarint(lcm_StateWriter* wr, uint64_t v)
+{
+    uint8_t bytes[10];
+    size_t n = 0;
+    do {
+        bytes[n++] = (uint8_t)((v & 0x7f) | (v > 0x7f ? 0x80 : 0));
+        v >>= 7;
+    } while (v > 0);
+    lcm_state_put(wr, bytes, n);
+}
+
+static void lcm_state_putint32(lcm_StateWriter* wr, int32_t v)
+{
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; ++i) {
+        bytes[i] = (uint8_t)((uint32_t)v >> (i * 8));
+    }
+    lcm_state_put(wr, bytes, sizeof(bytes));
+}
+
+// Writes value at stack `index`, which is to be a boolean, number, string or
+// table of such values.
+static void lcm_state_putvalue(
+    lua_State* L, lcm_StateWriter* wr, int index, int depth)
+{
+    index = ABSINDEX(L, index);
+    switch (lua_type(L, index)) {
+    case LUA_TBOOLEAN:
+        lcm_state_putbyte(wr,
+            lua_toboolean(L, index) ? LCM_STATE_TTRUE : LCM_STATE_TFALSE);
+        break;
+
+    case LUA_TNUMBER: {
+        const double n = (double)lua_tonumber(L, index);
+
+        // Integral numbers, which most are, are written as varints.
+        if (n >= -9007199254740992.0 && n <= 9007199254740992.0
+            && n == (double)(int64_t)n && !(n == 0.0 && signbit(n))) {
+            const int64_t i = (int64_t)n;
+            lcm_state_putbyte(wr, LCM_STATE_TINTEGER);
+            lcm_state_putvarint(
+                wr, ((uint64_t)i << 1) ^ (uint64_t)(i < 0 ? -1 : 0));
+            break;
+        }
+        uint64_t bits;
+        memcpy(&bits, &n, sizeof(bits));
+        uint8_t bytes[9] = { LCM_STATE_TNUMBER };
+        for (int i = 0; i < 8; ++i) {
+            bytes[i + 1] = (uint8_t)(bits >> (i * 8));
+        }
+        lcm_state_put(wr, bytes, sizeof(bytes));
+        break;
+    }
+    case LUA_TSTRING: {
+        size_t length;
+        const char* string = lua_tolstring(L, index, &length);
+        lcm_state_putbyte(wr, LCM_STATE_TSTRING);
+        lcm_state_putvarint(wr, length);
+        lcm_state_put(wr, string, length);
+        break;
+    }
+    case LUA_TTABLE:
+        if (depth >= LCM_STATE_DEPTH || !lua_checkstack(L, 3)) {
+            wr->status = LCM_ERRSTATE;
+            break;
+        }
+        lcm_state_putbyte(wr, LCM_STATE_TTABLE);
+        lua_pushnil(L);
+        while (lua_next(L, index) != 0) {
+            lcm_state_putvalue(L, wr, -2, depth + 1);
+            lcm_state_putvalue(L, wr, -1, depth + 1);
+            lua_pop(L, 1);
+            if (wr->status != 0) {
+                lua_pop(L, 1);
+                return;
+            }
+        }
+        lcm_state_putbyte(wr, LCM_STATE_TEND);
+        break;
+
+    default:
+        wr->status = LCM_ERRSTATE;
+        break;
+    }
+}
+
+// Pushes copy of value at stack `index`, copying tables by contents.
+static void lcm_state_copy(lua_State* L, int index, int depth)
+{
+    index = ABSINDEX(L, index);
+    if (lua_type(L, index) != LUA_TTABLE || depth >= LCM_STATE_DEPTH
+        || !lua_checkstack(L, 4)) {
+        lua_pushvalue(L, index);
+        return;
+    }
+    lua_newtable(L);
+    lua_pushnil(L);
+    while (lua_next(L, index) != 0) {
+        lua_pushvalue(L, -2);
+        lcm_state_copy(L, -2, depth + 1);
+        lua_rawset(L, -5);
+        lua_pop(L, 1);
+    }
+}
+
+// Writes key of set or delete entry at stack `key`, or fails if it is a table,
+// as its identity cannot be restored.
+static void lcm_state_putkey(lua_State* L, lcm_StateWriter* wr, int key)
+{
+    if (lua_type(L, key) == LUA_TTABLE) {
+        wr->status = LCM_ERRSTATE;
+        return;
+    }
+    lcm_state_putvalue(L, wr, key, 0);
+}
+
+// Writes set or delete entry `tag` and the path of key at stack `key`,
+// beginning the record of the lambda of `d` first, if not yet begun.
+static void lcm_state_putpath(lua_State* L, lcm_StateWriter* wr,
+    lcm_StateDelta* d, uint8_t tag, int key)
+{
+    key = ABSINDEX(L, key);
+    if (!d->changed) {
+        lcm_state_putbyte(wr, LCM_STATE_TLAMBDA);
+        lcm_state_putint32(wr, d->lambda_id);
+        d->changed = 1;
+    }
+    lcm_state_putbyte(wr, tag);
+    lcm_state_putvarint(wr, (uint64_t)d->depth + 1);
+    for (int i = 0; i < d->depth; ++i) {
+        lcm_state_putkey(L, wr, d->keys[i]);
+    }
+    lcm_state_putkey(L, wr, key);
+}
+
+// Writes changes made to table at `index` since its copy at `shadow` was made,
+// descending into tables present in both, and updates the copy to match.
+static void lcm_state_putdelta(lua_State* L, lcm_StateWriter* wr,
+    lcm_StateDelta* d, int index, int shadow)
+{
+    index = ABSINDEX(L, index);
+    shadow = ABSINDEX(L, shadow);
+    if (d->depth >= LCM_STATE_DEPTH || !lua_checkstack(L, 5)) {
+        wr->status = LCM_ERRSTATE;
+        return;
+    }
+    // Write changed and added fields.
+    lua_pushnil(L);
+    while (lua_next(L, index) != 0) {
+        lua_pushvalue(L, -2);
+        lua_rawget(L, shadow);
+        if (lua_type(L, -2) == LUA_TTABLE && lua_type(L, -1) == LUA_TTABLE) {
+            d->keys[d->depth++] = lua_gettop(L) - 2;
+            lcm_state_putdelta(L, wr, d, -2, -1);
+            d->depth--;
+        } else if (!lua_rawequal(L, -2, -1)) {
+            lcm_state_putpath(L, wr, d, LCM_STATE_TSET, -3);
+            lcm_state_putvalue(L, wr, -2, d->depth + 1);
+            lua_pushvalue(L, -3);
+            lcm_state_copy(L, -3, d->depth + 1);
+            lua_rawset(L, shadow);
+        }
+        lua_pop(L, 2);
+        if (wr->status != 0) {
+            lua_pop(L, 1);
+            return;
+        }
+    }
+    // Write removed fields.
+    lua_pushnil(L);
+    while (lua_next(L, shadow) != 0) {
+        lua_pushvalue(L, -2);
+        lua_rawget(L, index);
+        if (lua_isnil(L, -1)) {
+            lcm_state_putpath(L, wr, d, LCM_STATE_TDEL, -3);
+            lua_pushvalue(L, -3);
+            lua_pushnil(L);
+            lua_rawset(L, shadow);
+        }
+        lua_pop(L, 2);
+        if (wr->status != 0) {
+            lua_pop(L, 1);
+            return;
+        }
+    }
+}
+
+int lcm_state_checkpoint(
+    lua_State* L, int index, int shadows, lcm_ClosureWrite w, int delta)
+{
+    index = ABSINDEX(L, index);
+    shadows = ABSINDEX(L, shadows);
+
+    lcm_StateWriter wr = {.w = w, .status = 0, .length = 0 };
+    lcm_state_put(&wr, LCM_STATE_MAGIC, 4);
+    lcm_state_putbyte(&wr, LCM_STATE_VERSION);
+
+    // Write deltas for lambdas whose state tables have copies, updating the
+    // copies as changes are found, and whole state tables for other lambdas.
+    lua_pushnil(L);
+    while (lua_next(L, index) != 0) {
+        const int32_t lambda_id = (int32_t)lua_tointeger(L, -2);
+        lua_pushvalue(L, -2);
+        lua_rawget(L, shadows);
+        if (delta && lua_type(L, -1) == LUA_TTABLE) {
+            lcm_StateDelta d = {.lambda_id = lambda_id, .changed = 0 };
+            lcm_state_putdelta(L, &wr, &d, -2, -1);
+            if (d.changed) {
+                lcm_state_putbyte(&wr, LCM_STATE_TEND);
+            }
+        } else {
+            lcm_state_putbyte(&wr, LCM_STATE_TLAMBDA);
+            lcm_state_putint32(&wr, lambda_id);
+            lcm_state_putvalue(L, &wr, -2, 0);
+            if (wr.status == 0) {
+                lua_pushvalue(L, -3);
+                lcm_state_copy(L, -3, 0);
+                lua_rawset(L, shadows);
+            }
+        }
+        lua_pop(L, 2);
+        if (wr.status != 0) {
+            lua_pop(L, 1);
+            break;
+        }
+    }
+    lcm_state_putbyte(&wr, LCM_STATE_TEND);
+    lcm_state_flush(&wr);
+
+    // Forget all copies if writing failed, as they may no longer match what
+    // was written.
+    if (wr.status != 0) {
+        lua_pushnil(L);
+        while (lua_next(L, index) != 0) {
+            lua_pop(L, 1);
+            lua_pushvalue(L, -1);
+            lua_pushnil(L);
+            lua_rawset(L, shadows);
+        }
+    }
+    return wr.status;
+}
+
+static int lcm_state_get(lcm_StateReader* rd, void* data, size_t length)
+{
+    uint8_t* bytes = data;
+    while (length > 0 && rd->status == 0) {
+        if (rd->offset == rd->length) {
+            rd->offset = 0;
+            rd->length
+                = rd->r.function(rd->r.context, rd->bytes, sizeof(rd->bytes));
+            if (rd->length == 0) {
+                rd->status = LCM_ERRIO;
+                break;
+            }
+        }
+        size_t n = rd->length - rd->offset;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(bytes, &rd->bytes[rd->offset], n);
+        rd->offset += n;
+        bytes += n;
+        length -= n;
+    }
+    return rd->status;
+}
+
+static uint8_t lcm_state_getbyte(lcm_StateReader* rd)
+{
+    uint8_t byte = 0;
+    lcm_state_get(rd, &byte, 1);
+    return byte;
+}
+
+static uint64_t lcm_state_getvarint(lcm_StateReader* rd)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const uint8_t byte = lcm_state_getbyte(rd);
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return v;
+        }
+    }
+    if (rd->status == 0) {
+        rd->status = LCM_ERRSTATE;
+    }
+    return 0;
+}
+
+static int32_t lcm_state_getint32(lcm_StateReader* rd)
+{
+    uint8_t bytes[4] = { 0 };
+    lcm_state_get(rd, bytes, sizeof(bytes));
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) {
+        v |= (uint32_t)bytes[i] << (i * 8);
+    }
+    return (int32_t)v;
+}
+
+// Reads value of type `tag` and pushes it. Always pushes one value, which is
+// only meaningful if reading succeeds.
+static void lcm_state_getvalue(
+    lua_State* L, lcm_StateReader* rd, uint8_t tag, int depth)
+{
+    switch (tag) {
+    case LCM_STATE_TFALSE:
+    case LCM_STATE_TTRUE:
+        lua_pushboolean(L, tag == LCM_STATE_TTRUE);
+        return;
+
+    case LCM_STATE_TINTEGER: {
+        const uint64_t v = lcm_state_getvarint(rd);
+        const int64_t i = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+        lua_pushnumber(L, (lua_Number)i);
+        return;
+    }
+    case LCM_STATE_TNUMBER: {
+        uint8_t bytes[8] = { 0 };
+        lcm_state_get(rd, bytes, sizeof(bytes));
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; ++i) {
+            bits |= (uint64_t)bytes[i] << (i * 8);
+        }
+        double n;
+        memcpy(&n, &bits, sizeof(n));
+        lua_pushnumber(L, (lua_Number)n);
+        return;
+    }
+    case LCM_STATE_TSTRING: {
+        uint64_t length = lcm_state_getvarint(rd);
+        luaL_Buffer b;
+        luaL_buffinit(L, &b);
+        while (length > 0 && rd->status == 0) {
+            const size_t n
+                = length < LUAL_BUFFERSIZE ? (size_t)length : LUAL_BUFFERSIZE;
+            if (lcm_state_get(rd, luaL_prepbuffer(&b), n) == 0) {
+                luaL_addsize(&b, n);
+            }
+            length -= n;
+        }
+        luaL_pushresult(&b);
+        return;
+    }
+    case LCM_STATE_TTABLE:
+        if (depth >= LCM_STATE_DEPTH || !lua_checkstack(L, 3)) {
+            break;
+        }
+        lua_newtable(L);
+        for (;;) {
+            const uint8_t key = lcm_state_getbyte(rd);
+            if (rd->status != 0 || key == LCM_STATE_TEND) {
+                return;
+            }
+            lcm_state_getvalue(L, rd, key, depth + 1);
+            lcm_state_getvalue(L, rd, lcm_state_getbyte(rd), depth + 1);
+
+            // Tables cannot have nil or NaN keys, or nil values.
+            if (rd->status != 0 || lua_isnil(L, -1)
+                || !lua_rawequal(L, -2, -2)) {
+                lua_pop(L, 2);
+                break;
+            }
+            lua_rawset(L, -3);
+        }
+        lua_pop(L, 1);
+        break;
+
+    default:
+        break;
+    }
+    if (rd->status == 0) {
+        rd->status = LCM_ERRSTATE;
+    }
+    lua_pushnil(L);
+}
+
+// Applies set or delete entry at stack `entry` to table at `index`. Missing
+// tables along the path of a set entry are created, and values set are copied
+// if `copy` is not `0`.
+static void lcm_state_apply(lua_State* L, int index, int entry, int copy)
+{
+    const int top = lua_gettop(L);
+    entry = ABSINDEX(L, entry);
+    lua_rawgeti(L, entry, 1);
+    const int keys = (int)lua_tointeger(L, -1);
+    lua_rawgeti(L, entry, keys + 2);
+    const int value = lua_gettop(L);
+    const int set = !lua_isnil(L, value);
+
+    lua_pushvalue(L, index);
+    for (int i = 2; i <= keys; ++i) {
+        lua_rawgeti(L, entry, i);
+        lua_pushvalue(L, -1);
+        lua_rawget(L, -3);
+        if (lua_type(L, -1) != LUA_TTABLE) {
+            if (!set) {
+                lua_settop(L, top);
+                return;
+            }
+            lua_pop(L, 1);
+            lua_newtable(L);
+            lua_pushvalue(L, -2);
+            lua_pushvalue(L, -2);
+            lua_rawset(L, -5);
+        }
+        lua_replace(L, -3);
+        lua_pop(L, 1);
+    }
+    lua_rawgeti(L, entry, keys + 1);
+    if (copy) {
+        lcm_state_copy(L, value, keys);
+    } else {
+        lua_pushvalue(L, value);
+    }
+    lua_rawset(L, -3);
+    lua_settop(L, top);
+}
+
+int lcm_state_restore(
+    lua_State* L, int index, int shadows, lcm_ClosureRead r)
+{
+    const int bottom = lua_gettop(L);
+    index = ABSINDEX(L, index);
+    shadows = ABSINDEX(L, shadows);
+
+    lcm_StateReader rd = {.r = r, .status = 0, .offset = 0, .length = 0 };
+    {
+        uint8_t header[5];
+        if (lcm_state_get(&rd, header, sizeof(header)) != 0) {
+            goto end;
+        }
+        if (memcmp(header, LCM_STATE_MAGIC, 4) != 0
+            || header[4] != LCM_STATE_VERSION) {
+            rd.status = LCM_ERRSTATE;
+            goto end;
+        }
+    }
+    // Read all records before applying any of them. Each record is a table
+    // with a lambda ID at index 1, and either a whole state table at index 2,
+    // or a list of set and delete entries at index 3. Each entry is a table
+    // holding its path length, its path keys and, if a set entry, its value.
+    lua_newtable(L);
+    const int records = lua_gettop(L);
+    int count = 0;
+    for (;;) {
+        const uint8_t tag = lcm_state_getbyte(&rd);
+        if (rd.status != 0) {
+            goto end;
+        }
+        if (tag == LCM_STATE_TEND) {
+            break;
+        }
+        if (tag != LCM_STATE_TLAMBDA) {
+            rd.status = LCM_ERRSTATE;
+            goto end;
+        }
+        lua_createtable(L, 3, 0);
+        lua_pushinteger(L, lcm_state_getint32(&rd));
+        lua_rawseti(L, -2, 1);
+
+        uint8_t entry = lcm_state_getbyte(&rd);
+        if (entry == LCM_STATE_TTABLE) {
+            lcm_state_getvalue(L, &rd, entry, 0);
+            lua_rawseti(L, -2, 2);
+        } else {
+            lua_newtable(L);
+            for (int n = 1; entry != LCM_STATE_TEND && rd.status == 0;
+                 entry = lcm_state_getbyte(&rd), ++n) {
+                const uint64_t length = lcm_state_getvarint(&rd);
+                if ((entry != LCM_STATE_TSET && entry != LCM_STATE_TDEL)
+                    || length == 0 || length > LCM_STATE_DEPTH) {
+                    rd.status = LCM_ERRSTATE;
+                    break;
+                }
+                const int keys = (int)length;
+                lua_createtable(L, keys + 2, 0);
+                lua_pushinteger(L, keys);
+                lua_rawseti(L, -2, 1);
+                for (int i = 0; i < keys && rd.status == 0; ++i) {
+                    lcm_state_getvalue(L, &rd, lcm_state_getbyte(&rd), 0);
+
+                    // Tables cannot have nil or NaN keys.
+                    if (lua_isnil(L, -1) || !lua_rawequal(L, -1, -1)) {
+                        lua_pop(L, 1);
+                        rd.status = rd.status != 0 ? rd.status : LCM_ERRSTATE;
+                        break;
+                    }
+                    lua_rawseti(L, -2, i + 2);
+                }
+                if (entry == LCM_STATE_TSET && rd.status == 0) {
+                    lcm_state_getvalue(
+                        L, &rd, lcm_state_getbyte(&rd), keys);
+                    lua_rawseti(L, -2, keys + 2);
+                }
+                if (rd.status != 0) {
+                    goto end;
+                }
+                lua_rawseti(L, -2, n);
+            }
+            if (rd.status != 0) {
+                goto end;
+            }
+            lua_rawseti(L, -2, 3);
+        }
+        lua_rawseti(L, records, ++count);
+    }
+    // Apply records to the state tables of registered lambdas.
+    for (int i = 1; i <= count; ++i) {
+        lua_rawgeti(L, records, i);
+        const int record = lua_gettop(L);
+        lua_rawgeti(L, record, 1);
+        const int id = lua_gettop(L);
+        lua_pushvalue(L, id);
+        lua_rawget(L, index);
+        if (lua_type(L, -1) != LUA_TTABLE) {
+            lua_settop(L, record - 1);
+            continue;
+        }
+        const int state = lua_gettop(L);
+        lua_pushvalue(L, id);
+        lua_rawget(L, shadows);
+        const int shadow = lua_gettop(L);
+        int copied = 0;
+
+        lua_rawgeti(L, record, 2);
+        if (lua_type(L, -1) == LUA_TTABLE) {
+            // Clear state table and fill it with restored fields.
+            lua_pushnil(L);
+            while (lua_next(L, state) != 0) {
+                lua_pop(L, 1);
+                lua_pushvalue(L, -1);
+                lua_pushnil(L);
+                lua_rawset(L, state);
+            }
+            lua_pushnil(L);
+            while (lua_next(L, -2) != 0) {
+                lua_pushvalue(L, -2);
+                lua_insert(L, -2);
+                lua_rawset(L, state);
+            }
+        } else {
+            // Apply entries to state table, and to its copy if it has one.
+            lua_rawgeti(L, record, 3);
+            const int entries = lua_gettop(L);
+            copied = lua_type(L, shadow) == LUA_TTABLE;
+            for (int j = 1;; ++j) {
+                lua_rawgeti(L, entries, j);
+                if (lua_isnil(L, -1)) {
+                    break;
+                }
+                lcm_state_apply(L, state, -1, 0);
+                if (copied) {
+                    lcm_state_apply(L, shadow, -1, 1);
+                }
+                lua_pop(L, 1);
+            }
+        }
+        // The restored state is the state as of the latest checkpoint.
+        if (!copied) {
+            lua_pushvalue(L, id);
+            lcm_state_copy(L, state, 0);
+            lua_rawset(L, shadows);
+        }
+        lua_settop(L, record - 1);
+    }
+
+end:
+    lua_settop(L, bottom);
+    return rd.status;
+}
@@ -0,0 +1,41 @@
+/**
+ * Lua/compute lambda state header.
+ *
+ * Checkpoints begin with the magic bytes `LCMK` and a version byte, which are
+ * followed by one record per included lambda and an end tag. Each record
+ * consists of a lambda tag, the lambda ID as a little-endian `i32`, and then
+ * either a whole state table, or a list of set and delete entries terminated
+ * by an end tag. Each entry consists of its tag, the number of keys in its
+ * path as a varint, the keys leading from the state table to the changed
+ * field and, for set entries, the new value. Values are encoded as a type tag
+ * followed by a varint, a little-endian double, a varint length and string
+ * bytes, or the key/value pairs of a table terminated by an end tag.
+ *
+ * @file
+ */
+#ifndef lcmstate_h
+#define lcmstate_h
+
+#include "lcm.h"
+
+/**
+ * Writes checkpoint of state tables in table at stack `index`, keyed by lambda
+ * ID, to `w`. Copies of the written tables are kept in table at `shadows`. If
+ * `delta` is not `0`, only changes since those copies were made are written,
+ * and the copies are updated with the changes as they are found.
+ *
+ * Returns `0` (OK), `LCM_ERRIO` or `LCM_ERRSTATE`.
+ */
+int lcm_state_checkpoint(
+    lua_State* L, int index, int shadows, lcm_ClosureWrite w, int delta);
+
+/**
+ * Reads checkpoint from `r` into state tables in table at stack `index`,
+ * keyed by lambda ID, and updates their copies in table at `shadows`.
+ *
+ * Returns `0` (OK), `LCM_ERRIO` or `LCM_ERRSTATE`.
+ */
+int lcm_state_restore(
+    lua_State* L, int index, int shadows, lcm_ClosureRead r);
+
+#endif
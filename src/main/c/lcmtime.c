@@ -0,0 +1,11 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "lcmtime.h"
+#include <time.h>
+
+uint64_t lcm_time_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,19 @@
+/**
+ * Lua/compute time header.
+ *
+ * @file
+ */
+#ifndef lcmtime_h
+#define lcmtime_h
+
+#include <stdint.h>
+
+/**
+ * Returns nanoseconds elapsed since some arbitrary point in time.
+ *
+ * The returned value is monotonic, making it suitable for measuring durations,
+ * but it has no relation to wall clock time.
+ */
+uint64_t lcm_time_now(void);
+
+#endif
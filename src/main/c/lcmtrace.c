@@ -0,0 +1,104 @@
+#include "lcmtrace.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char* lcm_trace_phasename(lcm_TracePhase phase)
+{
+    switch (phase) {
+    case LCM_PHASE_LOOKUP:
+        return "lookup";
+    case LCM_PHASE_DECODE:
+        return "decode";
+    case LCM_PHASE_CACHE:
+        return "cache";
+    case LCM_PHASE_FETCH:
+        return "fetch";
+    case LCM_PHASE_PUSH:
+        return "push";
+    case LCM_PHASE_PCALL:
+        return "pcall";
+    case LCM_PHASE_RESULT:
+        return "result";
+    case LCM_PHASE_CALLBACK:
+        return "callback";
+    case LCM_PHASE_LOAD:
+        return "load";
+    case LCM_PHASE_EXEC:
+        return "exec";
+    case LCM_PHASE_LOG:
+        return "log";
+    default:
+        return "?";
+    }
+}
+
+void lcm_trace_record(lcm_Trace* t, lcm_TracePhase phase, int32_t lambda_id,
+    int32_t batch_id, uint64_t begin, uint64_t end)
+{
+    lcm_TraceEvent* event = &t->events[t->head];
+    event->begin = begin;
+    event->end = end;
+    event->lambda_id = lambda_id;
+    event->batch_id = batch_id;
+    event->phase = phase;
+
+    t->head = (t->head + 1) % LCM_TRACE_CAPACITY;
+    if (t->count < LCM_TRACE_CAPACITY) {
+        t->count++;
+    } else {
+        t->overwritten++;
+    }
+}
+
+static int lcm_trace_puts(lcm_ClosureWrite w, const char* string)
+{
+    return w.function(w.context, string, strlen(string));
+}
+
+int lcm_trace_write(lcm_Trace* t, lcm_ClosureWrite w)
+{
+    int status = 0;
+    if (lcm_trace_puts(w, "{\"traceEvents\":[") != 0) {
+        status = LCM_ERRIO;
+        goto end;
+    }
+    const size_t tail
+        = (t->head + LCM_TRACE_CAPACITY - t->count) % LCM_TRACE_CAPACITY;
+    for (size_t i = 0; i < t->count; ++i) {
+        const lcm_TraceEvent* event
+            = &t->events[(tail + i) % LCM_TRACE_CAPACITY];
+
+        // Chrome trace timestamps are given in microseconds.
+        char buffer[256];
+        const int length = snprintf(buffer, sizeof(buffer),
+            "%s{\"name\":\"%s\",\"cat\":\"lcm\",\"ph\":\"%s\","
+            "\"ts\":%" PRIu64 ".%03u,\"dur\":%" PRIu64 ".%03u,"
+            "\"pid\":1,\"tid\":1,"
+            "\"args\":{\"lambda_id\":%" PRId32 ",\"batch_id\":%" PRId32 "}}",
+            i == 0 ? "" : ",", lcm_trace_phasename(event->phase),
+            event->phase == LCM_PHASE_LOG ? "i" : "X", event->begin / 1000,
+            (unsigned)(event->begin % 1000), (event->end - event->begin) / 1000,
+            (unsigned)((event->end - event->begin) % 1000), event->lambda_id,
+            event->batch_id);
+        if (w.function(w.context, buffer, (size_t)length) != 0) {
+            status = LCM_ERRIO;
+            goto end;
+        }
+    }
+    {
+        char buffer[64];
+        const int length = snprintf(buffer, sizeof(buffer),
+            "],\"otherData\":{\"overwritten\":%" PRIu64 "}}", t->overwritten);
+        if (w.function(w.context, buffer, (size_t)length) != 0) {
+            status = LCM_ERRIO;
+            goto end;
+        }
+    }
+
+end:
+    t->head = 0;
+    t->count = 0;
+    t->overwritten = 0;
+    return status;
+}
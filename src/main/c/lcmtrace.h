@@ -0,0 +1,106 @@
+/**
+ * Lua/compute tracing header.
+ *
+ * When compiled with `LCM_USE_TRACE` defined, the time spent in each phase of
+ * `lcm_register()` and `lcm_process()` is recorded into a ring buffer owned by
+ * the Lua state. If `LCM_USE_SDT` is also defined, every recorded phase is
+ * additionally reported via a USDT probe named `lcm:phase`, which can be
+ * consumed by `perf`, `bpftrace`, SystemTap, or similar tools.
+ *
+ * Without `LCM_USE_TRACE` all tracing macros expand to nothing.
+ *
+ * @file
+ */
+#ifndef lcmtrace_h
+#define lcmtrace_h
+
+#include "lcm.h"
+
+/** Traced phases. */
+typedef enum {
+    LCM_PHASE_LOOKUP, ///< LCM state object lookup.
+    LCM_PHASE_DECODE, ///< Batch data decoding.
+    LCM_PHASE_CACHE, ///< Result cache lookup.
+    LCM_PHASE_FETCH, ///< Lambda function lookup.
+    LCM_PHASE_PUSH, ///< Pushing of batch data to Lua stack.
+    LCM_PHASE_PCALL, ///< Lambda function invocation.
+    LCM_PHASE_RESULT, ///< Result conversion and encoding.
+    LCM_PHASE_CALLBACK, ///< Result closure invocation.
+    LCM_PHASE_LOAD, ///< Loading of lambda program.
+    LCM_PHASE_EXEC, ///< Evaluation of lambda program.
+    LCM_PHASE_LOG, ///< `lcm:log()` call. Has no duration.
+} lcm_TracePhase;
+
+/** Trace event. */
+typedef struct {
+    uint64_t begin, end;
+    int32_t lambda_id, batch_id;
+    lcm_TracePhase phase;
+} lcm_TraceEvent;
+
+/** Trace ring buffer. */
+typedef struct {
+    size_t head, count;
+    uint64_t overwritten;
+    lcm_TraceEvent events[LCM_TRACE_CAPACITY];
+} lcm_Trace;
+
+/**
+ * Records event in trace ring buffer, overwriting the oldest event if the
+ * buffer is full.
+ */
+void lcm_trace_record(lcm_Trace* t, lcm_TracePhase phase, int32_t lambda_id,
+    int32_t batch_id, uint64_t begin, uint64_t end);
+
+/**
+ * Writes all events in trace ring buffer to `w` as Chrome trace event JSON,
+ * and then clears the buffer. The number of events overwritten since the
+ * buffer was last cleared is written as `otherData.overwritten`.
+ *
+ * Returns `0` (OK) or `LCM_ERRIO`.
+ */
+int lcm_trace_write(lcm_Trace* t, lcm_ClosureWrite w);
+
+#ifdef LCM_USE_TRACE
+#include "lcmtime.h"
+
+#ifdef LCM_USE_SDT
+#include <sys/sdt.h>
+#define LCM_TRACE_PROBE(ph, lambda_id, batch_id, duration) \
+    DTRACE_PROBE4(lcm, phase, ph, lambda_id, batch_id, duration)
+#else
+#define LCM_TRACE_PROBE(ph, lambda_id, batch_id, duration)
+#endif
+
+/** Declares and initializes phase timestamp variable `mark`. */
+#define LCM_TRACE_MARK(mark) uint64_t mark = lcm_time_now()
+
+/**
+ * Records phase that begun at `mark` and ends now, attributing it to the
+ * lambda and batch currently active in `state`. `mark` is set to now.
+ */
+#define LCM_TRACE_PHASE(state, phase, mark)                               \
+    do {                                                                  \
+        const uint64_t _now = lcm_time_now();                             \
+        lcm_trace_record((state)->trace, (phase), (state)->lambda_id,     \
+            (state)->batch_id, (mark), _now);                             \
+        LCM_TRACE_PROBE((phase), (state)->lambda_id, (state)->batch_id,   \
+            _now - (mark));                                               \
+        (mark) = _now;                                                    \
+    } while (0)
+
+/** Records instantaneous event. */
+#define LCM_TRACE_INSTANT(state, phase)                                   \
+    do {                                                                  \
+        const uint64_t _now = lcm_time_now();                             \
+        lcm_trace_record((state)->trace, (phase), (state)->lambda_id,     \
+            (state)->batch_id, _now, _now);                               \
+        LCM_TRACE_PROBE((phase), (state)->lambda_id, (state)->batch_id, 0); \
+    } while (0)
+#else
+#define LCM_TRACE_MARK(mark)
+#define LCM_TRACE_PHASE(state, phase, mark)
+#define LCM_TRACE_INSTANT(state, phase)
+#endif
+
+#endif
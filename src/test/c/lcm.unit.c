@@ -1,8 +1,11 @@
 #include "../../main/c/lcm.h"
+#include "../../main/c/lcmcapture.h"
 #include "unit.h"
 #include <lauxlib.h>
 #include <lua.h>
 #include <lualib.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -22,21 +25,864 @@ void provider_lua_state(unit_T* T, unit_TestFunction t)
 }
 
 //{ Test cases.
+void test_cache(unit_T* T, void* arg);
+void test_cache_lru(unit_T* T, void* arg);
+void test_capture(unit_T* T, void* arg);
+void test_checkpoint(unit_T* T, void* arg);
+void test_checkpoint_delta(unit_T* T, void* arg);
+void test_checkpoint_invalid(unit_T* T, void* arg);
+void test_codec(unit_T* T, void* arg);
+void test_codec_nested(unit_T* T, void* arg);
+void test_jit(unit_T* T, void* arg);
 void test_log(unit_T* T, void* arg);
+void test_log_buffer(unit_T* T, void* arg);
+void test_log_buffer_defer(unit_T* T, void* arg);
+void test_log_buffer_large(unit_T* T, void* arg);
+void test_log_invalid(unit_T* T, void* arg);
+void test_perfstats(unit_T* T, void* arg);
 void test_process(unit_T* T, void* arg);
+void test_process_vector(unit_T* T, void* arg);
+void test_profile(unit_T* T, void* arg);
+void test_trace(unit_T* T, void* arg);
 //}
 
 void suite_lcm(unit_T* T)
 {
+    unit_run_test(T, test_cache, provider_lua_state);
+    unit_run_test(T, test_cache_lru, provider_lua_state);
+    unit_run_test(T, test_capture, provider_lua_state);
+    unit_run_test(T, test_checkpoint, provider_lua_state);
+    unit_run_test(T, test_checkpoint_delta, provider_lua_state);
+    unit_run_test(T, test_checkpoint_invalid, provider_lua_state);
+    unit_run_test(T, test_codec, provider_lua_state);
+    unit_run_test(T, test_codec_nested, provider_lua_state);
+    unit_run_test(T, test_jit, provider_lua_state);
     unit_run_test(T, test_log, provider_lua_state);
+    unit_run_test(T, test_log_buffer, provider_lua_state);
+    unit_run_test(T, test_log_buffer_defer, provider_lua_state);
+    unit_run_test(T, test_log_buffer_large, provider_lua_state);
+    unit_run_test(T, test_log_invalid, provider_lua_state);
+    unit_run_test(T, test_perfstats, provider_lua_state);
     unit_run_test(T, test_process, provider_lua_state);
+    unit_run_test(T, test_process_vector, provider_lua_state);
+    unit_run_test(T, test_profile, provider_lua_state);
+    unit_run_test(T, test_trace, provider_lua_state);
 }
 
 //{ Callbacks used by test cases.
 static void f_log(void* context, const lcm_LogEntry* entry);
+static void f_log_batch(void* context, const lcm_LogEntry* entries,
+    size_t count, uint64_t dropped);
+static void f_log_totals(void* context, const lcm_LogEntry* entries,
+    size_t count, uint64_t dropped);
 static void f_batch(void* context, const lcm_Batch* batch);
+static void f_batch_nested(void* context, const lcm_Batch* batch);
+static void f_batch_append(void* context, const lcm_Batch* batch);
+static size_t f_code(void* context, const uint8_t* in, size_t in_length,
+    uint8_t* out, size_t out_capacity);
+static int f_write(void* context, const void* data, size_t length);
+static size_t f_read(void* context, void* data, size_t length);
+static int f_append(void* context, const void* data, size_t length);
 //}
 
+//{ Helpers used by test cases.
+#ifdef LCM_USE_TRACE
+static int json_valid(const char* json);
+#endif
+//}
+
+/** Output buffer used by `f_write`. */
+typedef struct {
+    uint8_t bytes[512];
+    size_t length;
+} Output;
+
+/** Log delivery totals collected by `f_log_totals`. */
+typedef struct {
+    size_t deliveries, entries, longest;
+    uint64_t dropped;
+} LogTotals;
+
+/** Results collected by `f_batch_nested`. */
+typedef struct {
+    lua_State* L;
+    int status;
+    char outer[8], inner[8];
+} Nested;
+
+/** Growable, NUL-terminated, output buffer used by `f_append`. */
+typedef struct {
+    char* bytes;
+    size_t length, capacity;
+} Sink;
+
+/** Input buffer used by `f_read`. */
+typedef struct {
+    const uint8_t* bytes;
+    size_t length;
+    size_t offset;
+} Input;
+
+void test_cache(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM.
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L, &(lcm_Config){ .cache = { .capacity = 16 } });
+    }
+    // Register pure job that counts its invocations.
+    const char* lua = "lcm:register(function (batch)\n"
+                      "  calls = (calls or 0) + 1\n"
+                      "  return batch:upper()\n"
+                      "end)";
+    const lcm_Lambda l = {
+        .lambda_id = 3,
+        .flags = LCM_LAMBDA_FPURE,
+        .program = {.lua = (char*)lua, .length = strlen(lua) },
+    };
+    {
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+    // Process same batch twice.
+    lcm_Batch result_batch = {.lambda_id = 0 };
+    const lcm_Batch input_batch = {
+        .lambda_id = 3,
+        .batch_id = 1,
+        .data = {
+            .bytes = (uint8_t*)"hello",
+            .length = 5,
+        },
+    };
+    const lcm_ClosureBatch result_closure = {
+        .context = &result_batch,
+        .function = f_batch,
+    };
+    for (int i = 0; i < 2; ++i) {
+        result_batch = (lcm_Batch){.lambda_id = 0 };
+        const int status = lcm_process(L, input_batch, result_closure);
+        if (status != 0) {
+            unit_failf(T, "[lcm_process] %s", lcm_errstr(status));
+        }
+        unit_assert(T, result_batch.data.bytes != NULL
+                && memcmp(result_batch.data.bytes, "HELLO", 5) == 0);
+    }
+    // Verify that the second batch never reached the job function.
+    {
+        lua_getglobal(L, "calls");
+        unit_assert(T, lua_tointeger(L, -1) == 1);
+        lua_pop(L, 1);
+
+        lcm_CacheStats stats;
+        unit_assert(T, lcm_cachestats(L, &stats) == 0);
+        unit_assert(T, stats.hits == 1);
+        unit_assert(T, stats.misses == 1);
+        unit_assert(T, stats.entries == 1);
+    }
+    // Verify that registering the job again invalidates its cached results.
+    {
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+        lcm_CacheStats stats;
+        unit_assert(T, lcm_cachestats(L, &stats) == 0);
+        unit_assert(T, stats.entries == 0);
+    }
+}
+
+// Processes batch with single byte `data` using identified lambda, and returns
+// the total number of calls made to the lambda so far.
+static lua_Integer process_counted(
+    unit_T* T, lua_State* L, int32_t lambda_id, uint8_t data)
+{
+    lcm_Batch result_batch = {.lambda_id = 0 };
+    const lcm_Batch b = {
+        .lambda_id = lambda_id,
+        .data = {.bytes = &data, .length = 1 },
+    };
+    const lcm_ClosureBatch c = {.context = &result_batch, .function = f_batch };
+    const int status = lcm_process(L, b, c);
+    if (status != 0) {
+        unit_failf(T, "[lcm_process] %s", lcm_errstr(status));
+    }
+    lua_getglobal(L, "calls");
+    const lua_Integer calls = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return calls;
+}
+
+void test_cache_lru(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM with cache consisting of a single set.
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L, &(lcm_Config){.cache = {.capacity = LCM_CACHE_WAYS } });
+    }
+    // Register pure job that counts its invocations.
+    {
+        const char* lua = "lcm:register(function (batch)\n"
+                          "  calls = (calls or 0) + 1\n"
+                          "  return batch:upper()\n"
+                          "end)";
+        const lcm_Lambda l = {
+            .lambda_id = 3,
+            .flags = LCM_LAMBDA_FPURE,
+            .program = {.lua = (char*)lua, .length = strlen(lua) },
+        };
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+    // Fill set, and then use its oldest result again.
+    for (uint8_t i = 0; i < LCM_CACHE_WAYS; ++i) {
+        unit_assert(T, process_counted(T, L, 3, 'a' + i) == i + 1);
+    }
+    unit_assert(T, process_counted(T, L, 3, 'a') == LCM_CACHE_WAYS);
+
+    // Insert one more result, which must evict the least recently used result
+    // rather than the oldest one.
+    unit_assert(T, process_counted(T, L, 3, 'z') == LCM_CACHE_WAYS + 1);
+    {
+        lcm_CacheStats stats;
+        unit_assert(T, lcm_cachestats(L, &stats) == 0);
+        unit_assert(T, stats.evictions == 1);
+        unit_assert(T, stats.entries == LCM_CACHE_WAYS);
+    }
+    unit_assert(T, process_counted(T, L, 3, 'a') == LCM_CACHE_WAYS + 1);
+    unit_assert(T, process_counted(T, L, 3, 'z') == LCM_CACHE_WAYS + 1);
+    unit_assert(T, process_counted(T, L, 3, 'b') == LCM_CACHE_WAYS + 2);
+}
+
+void test_capture(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM.
+    Output output = {.length = 0 };
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L, &(lcm_Config){
+            .capture = {.context = &output, .function = f_write },
+        });
+    }
+    // Register job with JIT settings and warmup batches, as well as a job
+    // failing to register, and process one good and one bad batch.
+    const char* lua = "lcm:register(function (batch)\n"
+                      "  return batch:upper()\n"
+                      "end)";
+    const char* bad = "error('bad')";
+    {
+        const lcm_Batch warmup[] = {
+            {.batch_id = 7, .data = {.bytes = (uint8_t*)"w", .length = 1 } },
+            {.batch_id = 8, .data = {.bytes = (uint8_t*)"ww", .length = 2 } },
+        };
+        const lcm_Lambda l = {
+            .lambda_id = 4,
+            .program = {.lua = (char*)lua, .length = strlen(lua) },
+            .jit = {.mode = LCM_JIT_ON, .opt = "3", .hotloop = 5 },
+            .warmup = {.batches = warmup, .count = 2, .rounds = 3 },
+        };
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+        const lcm_Lambda l_bad = {
+            .lambda_id = 6,
+            .program = {.lua = (char*)bad, .length = strlen(bad) },
+        };
+        unit_assert(T, lcm_register(L, l_bad) != 0);
+
+        lcm_Batch result_batch;
+        const lcm_ClosureBatch c = {
+            .context = &result_batch,
+            .function = f_batch,
+        };
+        lcm_Batch b = {
+            .lambda_id = 4,
+            .batch_id = 1,
+            .data = {.bytes = (uint8_t*)"abc", .length = 3 },
+        };
+        unit_assert(T, lcm_process(L, b, c) == 0);
+        b.lambda_id = 5;
+        b.batch_id = 2;
+        unit_assert(T, lcm_process(L, b, c) == LCM_ERRNOLAMBDA);
+        unit_assert(T, lcm_capturestatus(L) == 0);
+    }
+    // Verify captured records.
+    {
+        lcm_CaptureRecord r;
+        size_t offset = 0, n;
+
+        n = lcm_capture_parse(output.bytes, output.length, &r);
+        unit_assert(T, n > 0 && r.type == LCM_CAPTURE_LAMBDA);
+        unit_assert(T, r.lambda.lambda_id == 4);
+        unit_assert(T, r.lambda.program.length == strlen(lua)
+                && memcmp(r.lambda.program.lua, lua, strlen(lua)) == 0);
+        unit_assert(T, r.lambda.jit.mode == LCM_JIT_ON);
+        unit_assert(T, r.lambda.jit.opt != NULL
+                && strcmp(r.lambda.jit.opt, "3") == 0);
+        unit_assert(T, r.lambda.jit.hotloop == 5);
+        unit_assert(T, r.lambda.warmup.count == 2);
+        unit_assert(T, r.lambda.warmup.rounds == 3);
+        {
+            lcm_Batch warmup[2];
+            lcm_capture_warmup(&r, warmup);
+            unit_assert(T, r.lambda.warmup.batches == warmup);
+            unit_assert(T, warmup[0].batch_id == 7);
+            unit_assert(T, warmup[0].data.length == 1
+                    && warmup[0].data.bytes[0] == 'w');
+            unit_assert(T, warmup[1].batch_id == 8);
+            unit_assert(T, warmup[1].data.length == 2
+                    && memcmp(warmup[1].data.bytes, "ww", 2) == 0);
+        }
+        offset += n;
+
+        n = lcm_capture_parse(
+            &output.bytes[offset], output.length - offset, &r);
+        unit_assert(T, n > 0 && r.type == LCM_CAPTURE_LAMBDA);
+        unit_assert(T, r.lambda.lambda_id == 6);
+        unit_assert(T, r.lambda.jit.opt == NULL);
+        unit_assert(T, r.lambda.warmup.count == 0);
+        offset += n;
+
+        n = lcm_capture_parse(
+            &output.bytes[offset], output.length - offset, &r);
+        unit_assert(T, n > 0 && r.type == LCM_CAPTURE_BATCH);
+        unit_assert(T, r.batch.lambda_id == 4 && r.batch.batch_id == 1);
+        unit_assert(T, r.batch.data.length == 3
+                && memcmp(r.batch.data.bytes, "abc", 3) == 0);
+        unit_assert(T, r.status == 0 && r.timestamp > 0);
+        offset += n;
+
+        n = lcm_capture_parse(
+            &output.bytes[offset], output.length - offset, &r);
+        unit_assert(T, n > 0 && r.type == LCM_CAPTURE_BATCH);
+        unit_assert(T, r.batch.lambda_id == 5 && r.batch.batch_id == 2);
+        unit_assert(T, r.status == LCM_ERRNOLAMBDA);
+        offset += n;
+
+        unit_assert(T, offset == output.length);
+    }
+    // Make sure that a failing capture closure is reported, and stops
+    // capturing.
+    {
+        static uint8_t large[sizeof(output.bytes)];
+        lcm_Batch result_batch;
+        const lcm_ClosureBatch c = {
+            .context = &result_batch,
+            .function = f_batch,
+        };
+        lcm_Batch b = {
+            .lambda_id = 4,
+            .data = {.bytes = large, .length = sizeof(large) },
+        };
+        unit_assert(T, lcm_process(L, b, c) == 0);
+        unit_assert(T, lcm_capturestatus(L) == LCM_ERRIO);
+
+        const size_t length = output.length;
+        b.data.length = 1;
+        unit_assert(T, lcm_process(L, b, c) == 0);
+        unit_assert(T, output.length == length);
+    }
+}
+
+void test_checkpoint(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    const char* lua = "local state = lcm:state({ count = 0, seen = {} })\n"
+                      "lcm:register(function (batch)\n"
+                      "  state.count = state.count + 1\n"
+                      "  state.seen[batch] = true\n"
+                      "  local seen = {}\n"
+                      "  for k in pairs(state.seen) do\n"
+                      "    seen[#seen + 1] = k\n"
+                      "  end\n"
+                      "  table.sort(seen)\n"
+                      "  return state.count .. table.concat(seen)\n"
+                      "end)";
+    const lcm_Lambda l = {
+        .lambda_id = 6,
+        .program = {.lua = (char*)lua, .length = strlen(lua) },
+    };
+    lcm_Batch result_batch = {.lambda_id = 0 };
+    const lcm_ClosureBatch c = {.context = &result_batch, .function = f_batch };
+    lcm_Batch b = {
+        .lambda_id = 6,
+        .data = {.bytes = (uint8_t*)"a", .length = 1 },
+    };
+
+    // Setup LCM and register stateful job.
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L, NULL);
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+    // Process batches, taking a full checkpoint and then a delta checkpoint,
+    // which only contains the changed count.
+    Output full = {.length = 0 }, delta = {.length = 0 };
+    {
+        const lcm_ClosureWrite w_full
+            = {.context = &full, .function = f_write };
+        const lcm_ClosureWrite w_delta
+            = {.context = &delta, .function = f_write };
+        unit_assert(T, lcm_process(L, b, c) == 0);
+        b.data.bytes = (uint8_t*)"b";
+        unit_assert(T, lcm_process(L, b, c) == 0);
+        unit_assert(T, lcm_checkpoint(L, w_full, 0) == 0);
+        unit_assert(T, lcm_process(L, b, c) == 0);
+        unit_assert(T, lcm_checkpoint(L, w_delta, LCM_CHECKPOINT_FDELTA) == 0);
+        unit_assert(T, delta.length > 0 && delta.length < full.length);
+    }
+    // Restore checkpoints into new Lua state and continue processing.
+    {
+        lua_State* L2 = luaL_newstate();
+        luaL_openlibs(L2);
+        lcm_openlib(L2, NULL);
+        unit_assert(T, lcm_register(L2, l) == 0);
+
+        Input in_full = {.bytes = full.bytes, .length = full.length };
+        Input in_delta = {.bytes = delta.bytes, .length = delta.length };
+        int status = lcm_restore(
+            L2, (lcm_ClosureRead){.context = &in_full, .function = f_read });
+        unit_assert(T, status == 0);
+        status = lcm_restore(
+            L2, (lcm_ClosureRead){.context = &in_delta, .function = f_read });
+        unit_assert(T, status == 0);
+
+        // Truncated checkpoints are rejected.
+        in_full.offset = 0;
+        in_full.length--;
+        status = lcm_restore(
+            L2, (lcm_ClosureRead){.context = &in_full, .function = f_read });
+        unit_assert(T, status == LCM_ERRIO);
+
+        b.data.bytes = (uint8_t*)"c";
+        unit_assert(T, lcm_process(L2, b, c) == 0);
+        unit_assert(T, result_batch.data.length == 4
+                && memcmp(result_batch.data.bytes, "4abc", 4) == 0);
+        lua_close(L2);
+    }
+}
+
+// Returns non-zero if `output` contains `length` `bytes`.
+static int output_contains(
+    const Output* output, const char* bytes, size_t length)
+{
+    for (size_t i = 0; i + length <= output->length; ++i) {
+        if (memcmp(&output->bytes[i], bytes, length) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Processes batch `data` using lambda 9 of `L`, and verifies its result.
+static void process_delta(
+    unit_T* T, lua_State* L, const char* data, const char* expected)
+{
+    lcm_Batch result_batch = {.lambda_id = 0 };
+    const lcm_ClosureBatch c = {.context = &result_batch, .function = f_batch };
+    const lcm_Batch b = {
+        .lambda_id = 9,
+        .data = {.bytes = (uint8_t*)data, .length = strlen(data) },
+    };
+    unit_assert(T, lcm_process(L, b, c) == 0);
+    unit_assert(T, result_batch.data.length == strlen(expected)
+            && memcmp(result_batch.data.bytes, expected, strlen(expected))
+                == 0);
+}
+
+void test_checkpoint_delta(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Job adding (+) and removing (-) keys of nested table, or clearing (!) a
+    // top-level field, returning the nested keys and cleared field marker.
+    const char* lua
+        = "local state = lcm:state({ log = { items = {} }, on = 1 })\n"
+          "lcm:register(function (batch)\n"
+          "  local op, key = batch:sub(1, 1), batch:sub(2)\n"
+          "  local items = state.log.items\n"
+          "  if op == '+' then items[key] = #key end\n"
+          "  if op == '-' then items[key] = nil end\n"
+          "  if op == '!' then state.on = nil end\n"
+          "  local keys = {}\n"
+          "  for k in pairs(items) do\n"
+          "    keys[#keys + 1] = k\n"
+          "  end\n"
+          "  table.sort(keys)\n"
+          "  return table.concat(keys) .. (state.on and '' or '!')\n"
+          "end)";
+    const lcm_Lambda l = {
+        .lambda_id = 9,
+        .program = {.lua = (char*)lua, .length = strlen(lua) },
+    };
+
+    // Setup LCM and register stateful job.
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L, NULL);
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+    // Take full checkpoint, and then delta checkpoint only containing the
+    // changed nested fields, each with its path. String keys of one byte are
+    // written as the string tag (5), their length and the byte, and delete
+    // entries as the delete tag (10) followed by their path length.
+    Output full = {.length = 0 }, delta = {.length = 0 };
+    {
+        process_delta(T, L, "+a", "a");
+        process_delta(T, L, "+b", "ab");
+        process_delta(T, L, "+c", "abc");
+        unit_assert(T,
+            lcm_checkpoint(L,
+                (lcm_ClosureWrite){.context = &full, .function = f_write }, 0)
+                == 0);
+        process_delta(T, L, "-b", "ac");
+        process_delta(T, L, "+d", "acd");
+        process_delta(T, L, "!", "acd!");
+        unit_assert(T,
+            lcm_checkpoint(L,
+                (lcm_ClosureWrite){.context = &delta, .function = f_write },
+                LCM_CHECKPOINT_FDELTA)
+                == 0);
+        unit_assert(T, output_contains(&full, "\x05\x01" "a", 3));
+        unit_assert(T, !output_contains(&delta, "\x05\x01" "a", 3));
+        unit_assert(T, !output_contains(&delta, "\x05\x01" "c", 3));
+        unit_assert(T, output_contains(&delta, "\x05\x01" "d", 3));
+        unit_assert(T, output_contains(&delta, "\x0a\x03\x05\x03log", 7));
+        unit_assert(T, output_contains(&delta, "\x0a\x01\x05\x02on", 6));
+    }
+    // Restore checkpoints into new Lua state, whose next delta checkpoint
+    // only contains what changed after the restored delta checkpoint.
+    {
+        lua_State* L2 = luaL_newstate();
+        luaL_openlibs(L2);
+        lcm_openlib(L2, NULL);
+        unit_assert(T, lcm_register(L2, l) == 0);
+
+        Input in_full = {.bytes = full.bytes, .length = full.length };
+        Input in_delta = {.bytes = delta.bytes, .length = delta.length };
+        unit_assert(T,
+            lcm_restore(L2,
+                (lcm_ClosureRead){.context = &in_full, .function = f_read })
+                == 0);
+        unit_assert(T,
+            lcm_restore(L2,
+                (lcm_ClosureRead){.context = &in_delta, .function = f_read })
+                == 0);
+        process_delta(T, L2, "+e", "acde!");
+
+        Output next = {.length = 0 };
+        unit_assert(T,
+            lcm_checkpoint(L2,
+                (lcm_ClosureWrite){.context = &next, .function = f_write },
+                LCM_CHECKPOINT_FDELTA)
+                == 0);
+        unit_assert(T, output_contains(&next, "\x05\x01" "e", 3));
+        unit_assert(T, !output_contains(&next, "\x05\x01" "d", 3));
+        unit_assert(T, !output_contains(&next, "\x05\x02on", 4));
+        lua_close(L2);
+    }
+}
+
+void test_checkpoint_invalid(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM and register job putting a function (f) or too deeply nested
+    // tables (d) in its state, or clearing its state (c).
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L, NULL);
+        const char* lua = "local state = lcm:state({})\n"
+                          "lcm:register(function (batch)\n"
+                          "  state.f, state.d = nil, nil\n"
+                          "  if batch == 'f' then state.f = print end\n"
+                          "  if batch == 'd' then\n"
+                          "    local t = state\n"
+                          "    for i = 1, 40 do\n"
+                          "      t.d = {}\n"
+                          "      t = t.d\n"
+                          "    end\n"
+                          "  end\n"
+                          "  return batch\n"
+                          "end)";
+        const lcm_Lambda l = {
+            .lambda_id = 10,
+            .program = {.lua = (char*)lua, .length = strlen(lua) },
+        };
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+    // Neither full nor delta checkpoints can be written while the state
+    // cannot be serialized.
+    {
+        const struct {
+            const char* batch;
+            int flags;
+            int status;
+        } steps[] = {
+            { "f", 0, LCM_ERRSTATE },
+            { "c", 0, 0 },
+            { "f", LCM_CHECKPOINT_FDELTA, LCM_ERRSTATE },
+            { "c", LCM_CHECKPOINT_FDELTA, 0 },
+            { "d", LCM_CHECKPOINT_FDELTA, LCM_ERRSTATE },
+            { "d", 0, LCM_ERRSTATE },
+        };
+        lcm_Batch result_batch = {.lambda_id = 0 };
+        const lcm_ClosureBatch c
+            = {.context = &result_batch, .function = f_batch };
+        for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); ++i) {
+            const lcm_Batch b = {
+                .lambda_id = 10,
+                .data = {.bytes = (uint8_t*)steps[i].batch, .length = 1 },
+            };
+            unit_assert(T, lcm_process(L, b, c) == 0);
+
+            Output output = {.length = 0 };
+            const lcm_ClosureWrite w
+                = {.context = &output, .function = f_write };
+            unit_assert(
+                T, lcm_checkpoint(L, w, steps[i].flags) == steps[i].status);
+        }
+    }
+}
+
+void test_codec(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM with codec that toggles the case of ASCII letters.
+    {
+        luaL_openlibs(L);
+        const lcm_Codec codec = {
+            .context = NULL,
+            .decode = f_code,
+            .encode = f_code,
+        };
+        lcm_openlib(L,
+            &(lcm_Config){
+                .codecs = {.list = &codec, .count = 1 },
+            });
+    }
+    // Register job.
+    {
+        const char* lua = "lcm:register(function (batch)\n"
+                          "  return batch:upper()\n"
+                          "end)";
+        const lcm_Lambda l = {
+            .lambda_id = 5,
+            .program = {.lua = (char*)lua, .length = strlen(lua) },
+        };
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+    // Process encoded batch using registered job.
+    lcm_Batch result_batch = {.lambda_id = 0 };
+    {
+        const lcm_Batch input_batch = {
+            .lambda_id = 5,
+            .batch_id = 1,
+            .encoding = 1,
+            .data = {
+                .bytes = (uint8_t*)"HELLO",
+                .length = 5,
+            },
+        };
+        const lcm_ClosureBatch result_closure = {
+            .context = &result_batch,
+            .function = f_batch,
+        };
+        const int status = lcm_process(L, input_batch, result_closure);
+        if (status != 0) {
+            unit_failf(T, "[lcm_process] %s", lcm_errstr(status));
+        }
+    }
+    // Verify that the job saw decoded data and that its result was encoded.
+    {
+        unit_assert(T, result_batch.encoding == 1);
+        unit_assert(T, result_batch.data.bytes != NULL
+                && memcmp(result_batch.data.bytes, "hello", 5) == 0);
+        unit_assert(T, result_batch.data.length == 5);
+    }
+}
+
+void test_codec_nested(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM with codec that toggles the case of ASCII letters.
+    {
+        luaL_openlibs(L);
+        const lcm_Codec codec = {
+            .context = NULL,
+            .decode = f_code,
+            .encode = f_code,
+        };
+        lcm_openlib(L,
+            &(lcm_Config){
+                .codecs = {.list = &codec, .count = 1 },
+            });
+    }
+    // Register job.
+    {
+        const char* lua = "lcm:register(function (batch)\n"
+                          "  return batch:upper()\n"
+                          "end)";
+        const lcm_Lambda l = {
+            .lambda_id = 5,
+            .program = {.lua = (char*)lua, .length = strlen(lua) },
+        };
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+    // Process encoded batch, processing another from its result closure.
+    Nested n = {.L = L, .status = -1 };
+    {
+        const lcm_Batch b = {
+            .lambda_id = 5,
+            .batch_id = 1,
+            .encoding = 1,
+            .data = {.bytes = (uint8_t*)"HELLO", .length = 5 },
+        };
+        const lcm_ClosureBatch c = {.context = &n, .function = f_batch_nested };
+        const int status = lcm_process(L, b, c);
+        if (status != 0) {
+            unit_failf(T, "[lcm_process] %s", lcm_errstr(status));
+        }
+    }
+    // Make sure the outer result was not overwritten by the nested one.
+    {
+        unit_assert(T, n.status == 0);
+        unit_assert(T, strcmp(n.inner, "world") == 0);
+        unit_assert(T, strcmp(n.outer, "hello") == 0);
+    }
+}
+
+void test_jit(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM, unless not running on LuaJIT.
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L, NULL);
+
+        lua_getglobal(L, "jit");
+        const int jit = lua_type(L, -1) == LUA_TTABLE;
+        lua_pop(L, 1);
+        if (!jit) {
+            unit_skip(T, "Not running on LuaJIT.");
+        }
+    }
+    // Register two jobs running the same hot loop, with and without JIT
+    // compilation, and warm up the first of them.
+    const char* lua = "lcm:register(function (batch)\n"
+                      "  calls = (calls or 0) + 1\n"
+                      "  local n = 0\n"
+                      "  for i = 1, 1000 do n = n + #batch end\n"
+                      "  return tostring(n)\n"
+                      "end)";
+    const lcm_Batch warmup[] = {
+        {.data = {.bytes = (uint8_t*)"a", .length = 1 } },
+        {.data = {.bytes = (uint8_t*)"bb", .length = 2 } },
+    };
+    lcm_Batch result_batch = {.lambda_id = 0 };
+    {
+        const lcm_Lambda on = {
+            .lambda_id = 14,
+            .program = {.lua = (char*)lua, .length = strlen(lua) },
+            .jit = {.mode = LCM_JIT_ON, .opt = " 3  maxtrace=1000 ",
+                .hotloop = 10 },
+            .warmup = {.batches = warmup, .count = 2, .rounds = 3 },
+        };
+        int status = lcm_register(L, on);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+        const lcm_Lambda off = {
+            .lambda_id = 15,
+            .program = {.lua = (char*)lua, .length = strlen(lua) },
+            .jit = {.mode = LCM_JIT_OFF },
+        };
+        status = lcm_register(L, off);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+        const lcm_Lambda bad = {
+            .lambda_id = 16,
+            .program = {.lua = (char*)lua, .length = strlen(lua) },
+            .jit = {.opt = "nosuchoption" },
+        };
+        unit_assert(T, lcm_register(L, bad) == LCM_ERRRUN);
+    }
+    // Verify that warmup batches were processed, but never delivered.
+    {
+        lua_getglobal(L, "calls");
+        unit_assert(T, lua_tointeger(L, -1) == 6);
+        lua_pop(L, 1);
+        unit_assert(T, result_batch.lambda_id == 0);
+    }
+    // Process batches with both jobs, and verify that traces are only
+    // counted for the job being compiled.
+    {
+        const lcm_ClosureBatch c
+            = {.context = &result_batch, .function = f_batch };
+        for (int32_t id = 14; id <= 15; ++id) {
+            const lcm_Batch b = {
+                .lambda_id = id,
+                .data = {.bytes = (uint8_t*)"hello", .length = 5 },
+            };
+            for (int i = 0; i < 10; ++i) {
+                unit_assert(T, lcm_process(L, b, c) == 0);
+            }
+            unit_assert(T, result_batch.lambda_id == id);
+        }
+        lcm_JitStats on, off;
+        unit_assert(T, lcm_jitstats(L, 14, &on) == 0);
+        unit_assert(T, lcm_jitstats(L, 15, &off) == 0);
+        unit_assert(T, on.traces > 0);
+        unit_assert(T, off.traces == 0);
+        unit_assert(T, lcm_jitstats(L, 17, &on) == LCM_ERRNOLAMBDA);
+    }
+    // Compile hot loop outside of any job, and verify that its traces are not
+    // counted for the job that ran last.
+    {
+        lcm_JitStats before, after;
+        unit_assert(T, lcm_jitstats(L, 15, &before) == 0);
+        const char* outside = "local n = 0\n"
+                              "for i = 1, 100000 do n = n + i % 7 end";
+        unit_assert(T,
+            luaL_loadbuffer(L, outside, strlen(outside), "=outside") == 0
+                && lua_pcall(L, 0, 0, 0) == 0);
+        unit_assert(T, lcm_jitstats(L, 15, &after) == 0);
+        unit_assert(T, after.traces == before.traces);
+        unit_assert(T, after.aborts == before.aborts);
+        unit_assert(T, after.flushes == before.flushes);
+    }
+}
+
 void test_log(unit_T* T, void* arg)
 {
     lua_State* L = arg;
@@ -109,6 +955,253 @@ void test_log(unit_T* T, void* arg)
     }
 }
 
+void test_log_buffer(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM.
+    lcm_LogEntry result_logs[4] = { {.lambda_id = 0 } };
+    {
+        lcm_openlib(L,
+            &(lcm_Config){
+                .log_level = LCM_LOG_INFO,
+                .log_buffer = {
+                    .closure = {
+                        .context = &result_logs,
+                        .function = f_log_batch,
+                    },
+                },
+            });
+    }
+    // Register job logging at different levels.
+    {
+        const char* lua = "lcm:register(function (batch)\n"
+                          "  lcm:log('a')\n"
+                          "  lcm:log(function () return 'b' end, lcm.WARN)\n"
+                          "  lcm:log(function () error('c') end, lcm.DEBUG)\n"
+                          "  return batch\n"
+                          "end)";
+        const lcm_Lambda l = {
+            .lambda_id = 4,
+            .program = {.lua = (char*)lua, .length = strlen(lua) },
+        };
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+    // Process batch using registered job.
+    lcm_Batch result_batch = {.lambda_id = 0 };
+    {
+        const lcm_Batch input_batch = {
+            .lambda_id = 4,
+            .batch_id = 5,
+            .data = {
+                .bytes = (uint8_t*)"hello",
+                .length = 5,
+            },
+        };
+        const lcm_ClosureBatch result_closure = {
+            .context = &result_batch,
+            .function = f_batch,
+        };
+        const int status = lcm_process(L, input_batch, result_closure);
+        if (status != 0) {
+            unit_failf(T, "[lcm_process] %s", lcm_errstr(status));
+        }
+    }
+    // Make sure both non-debug entries were delivered together.
+    {
+        unit_assert(T, result_logs[0].lambda_id == 4);
+        unit_assert(T, result_logs[0].batch_id == 5);
+        unit_assert(T, result_logs[0].level == LCM_LOG_INFO);
+        unit_assert(T, result_logs[0].message.length == 1
+                && result_logs[0].message.string[0] == 'a');
+        unit_assert(T, result_logs[1].level == LCM_LOG_WARN);
+        unit_assert(T, result_logs[1].message.length == 1
+                && result_logs[1].message.string[0] == 'b');
+        unit_assert(T, result_logs[1].timestamp >= result_logs[0].timestamp);
+        unit_assert(T, result_logs[2].lambda_id == 0);
+    }
+}
+
+void test_log_buffer_defer(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM with deferred delivery and room for only a few entries.
+    LogTotals totals = {.deliveries = 0 };
+    {
+        lcm_openlib(L,
+            &(lcm_Config){
+                .log_buffer = {
+                    .closure = {.context = &totals, .function = f_log_totals },
+                    .size = 256,
+                    .defer = 1,
+                },
+            });
+    }
+    // Register job logging more entries than fit in buffer.
+    const char* lua = "lcm:register(function (batch)\n"
+                      "  for i = 1, 10 do lcm:log('entry ' .. i) end\n"
+                      "  return batch\n"
+                      "end)";
+    const lcm_Lambda l = {
+        .lambda_id = 12,
+        .program = {.lua = (char*)lua, .length = strlen(lua) },
+    };
+    {
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+    // Process two batches, and make sure that entries not fitting in the
+    // buffer are dropped, counted, and delivered once per call.
+    lcm_Batch result_batch = {.lambda_id = 0 };
+    const lcm_Batch b = {
+        .lambda_id = 12,
+        .data = {.bytes = (uint8_t*)"hello", .length = 5 },
+    };
+    const lcm_ClosureBatch c = {.context = &result_batch, .function = f_batch };
+    for (size_t i = 1; i <= 2; ++i) {
+        unit_assert(T, lcm_process(L, b, c) == 0);
+        unit_assert(T, totals.deliveries == i);
+        unit_assert(T, totals.entries > 0 && totals.entries < 10 * i);
+        unit_assert(T, totals.entries + totals.dropped == 10 * i);
+    }
+}
+
+void test_log_buffer_large(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM with small log buffer, delivering entries early when full.
+    LogTotals totals = {.deliveries = 0 };
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L,
+            &(lcm_Config){
+                .log_buffer = {
+                    .closure = {.context = &totals, .function = f_log_totals },
+                    .size = 256,
+                },
+            });
+    }
+    // Register job logging one entry larger than the whole buffer.
+    const char* lua = "lcm:register(function (batch)\n"
+                      "  lcm:log('a')\n"
+                      "  lcm:log(string.rep('x', 1000))\n"
+                      "  lcm:log('b')\n"
+                      "  return batch\n"
+                      "end)";
+    const lcm_Lambda l = {
+        .lambda_id = 13,
+        .program = {.lua = (char*)lua, .length = strlen(lua) },
+    };
+    {
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+    // Make sure that all entries were delivered, none dropped.
+    {
+        lcm_Batch result_batch = {.lambda_id = 0 };
+        const lcm_Batch b = {
+            .lambda_id = 13,
+            .data = {.bytes = (uint8_t*)"hello", .length = 5 },
+        };
+        const lcm_ClosureBatch c
+            = {.context = &result_batch, .function = f_batch };
+        unit_assert(T, lcm_process(L, b, c) == 0);
+        unit_assert(T, totals.entries == 3);
+        unit_assert(T, totals.longest == 1000);
+        unit_assert(T, totals.dropped == 0);
+    }
+}
+
+void test_log_invalid(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM without any log closure, making all entries ignored.
+    luaL_openlibs(L);
+    lcm_openlib(L, NULL);
+
+    // Make sure messages of invalid types are rejected nonetheless.
+    const char* lua = "assert(pcall(lcm.log, lcm, 'a'))\n"
+                      "assert(pcall(lcm.log, lcm, function () end))\n"
+                      "assert(not pcall(lcm.log, lcm, {}))\n"
+                      "assert(not pcall(lcm.log, lcm, nil))\n";
+    if (luaL_loadbuffer(L, lua, strlen(lua), "=invalid") != 0
+        || lua_pcall(L, 0, 0, 0) != 0) {
+        unit_failf(T, "%s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+}
+
+void test_perfstats(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM with hardware counters.
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L, &(lcm_Config){.perf = 1 });
+    }
+    // Register job looping long enough to be counted.
+    const char* lua = "lcm:register(function (batch)\n"
+                      "  local n = 0\n"
+                      "  for i = 1, 10000 do n = n + #batch end\n"
+                      "  return tostring(n)\n"
+                      "end)";
+    const lcm_Lambda l = {
+        .lambda_id = 7,
+        .program = {.lua = (char*)lua, .length = strlen(lua) },
+    };
+    {
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+    // Process batches twice.
+    lcm_Batch result_batch = {.lambda_id = 0 };
+    const lcm_Batch input_batch = {
+        .lambda_id = 7,
+        .data = {.bytes = (uint8_t*)"hello", .length = 5 },
+    };
+    const lcm_ClosureBatch result_closure = {
+        .context = &result_batch,
+        .function = f_batch,
+    };
+    for (int i = 0; i < 2; ++i) {
+        const int status = lcm_process(L, input_batch, result_closure);
+        if (status != 0) {
+            unit_failf(T, "[lcm_process] %s", lcm_errstr(status));
+        }
+    }
+    // Verify counters, unless not available on this machine.
+    {
+        lcm_PerfStats stats;
+        const int status = lcm_perfstats(L, 7, &stats);
+        if (status == LCM_ERRNOPERF) {
+            unit_skip(T, "Performance counters unavailable.");
+        }
+        unit_assert(T, status == 0);
+        unit_assert(T, stats.calls + stats.unmeasured == 2);
+        unit_assert(T, (stats.available & LCM_PERF_FCYCLES) != 0);
+        if (stats.calls == 0) {
+            unit_skip(T, "Performance counters occupied.");
+        }
+        unit_assert(T, stats.cycles > 0);
+        unit_assert(T, (stats.available & LCM_PERF_FINSTRUCTIONS) == 0
+                || stats.instructions > 0);
+        unit_assert(T, lcm_perfstats(L, 8, &stats) == LCM_ERRNOLAMBDA);
+    }
+}
+
 void test_process(unit_T* T, void* arg)
 {
     lua_State* L = arg;
@@ -164,6 +1257,254 @@ void test_process(unit_T* T, void* arg)
     }
 }
 
+void test_process_vector(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM with result cache.
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L, &(lcm_Config){.cache = {.capacity = 16 } });
+    }
+    // Register vector jobs, counting their calls and inputs, and failing to
+    // produce results for inputs reading "bad". The second job is pure.
+    const char* lua = "lcm:register(function (batches)\n"
+                      "  calls = (calls or 0) + 1\n"
+                      "  inputs = (inputs or 0) + #batches\n"
+                      "  local results = {}\n"
+                      "  for i, batch in ipairs(batches) do\n"
+                      "    if batch ~= 'bad' then\n"
+                      "      results[i] = batch:upper()\n"
+                      "    end\n"
+                      "  end\n"
+                      "  return results\n"
+                      "end)";
+    for (int32_t id = 7; id <= 8; ++id) {
+        const lcm_Lambda l = {
+            .lambda_id = id,
+            .flags = LCM_LAMBDA_FVECTOR | (id == 8 ? LCM_LAMBDA_FPURE : 0),
+            .program = {.lua = (char*)lua, .length = strlen(lua) },
+        };
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+    Sink sink = {.bytes = NULL };
+    const lcm_ClosureBatch c = {.context = &sink, .function = f_batch_append };
+    lcm_ClosureBatch cs[5] = {c, c, c, c, c };
+    int statuses[5];
+
+    // Process consecutive batches of each lambda in a single call.
+    {
+        const lcm_Batch bs[5] = {
+            {.lambda_id = 7, .data = {.bytes = (uint8_t*)"a", .length = 1 } },
+            {.lambda_id = 7, .data = {.bytes = (uint8_t*)"bad", .length = 3 } },
+            {.lambda_id = 7, .data = {.bytes = (uint8_t*)"c", .length = 1 } },
+            {.lambda_id = 9, .data = {.bytes = (uint8_t*)"x", .length = 1 } },
+            {.lambda_id = 7, .data = {.bytes = (uint8_t*)"d", .length = 1 } },
+        };
+        unit_assert(T, lcm_processv(L, bs, cs, statuses, 5) == 3);
+        unit_assert(T, statuses[0] == 0);
+        unit_assert(T, statuses[1] == LCM_ERRNORESULT);
+        unit_assert(T, statuses[2] == 0);
+        unit_assert(T, statuses[3] == LCM_ERRNOLAMBDA);
+        unit_assert(T, statuses[4] == 0);
+        unit_assert(T, sink.bytes != NULL && strcmp(sink.bytes, "ACD") == 0);
+    }
+    // Process single batch, which is passed on its own.
+    {
+        const lcm_Batch b = {
+            .lambda_id = 7,
+            .data = {.bytes = (uint8_t*)"e", .length = 1 },
+        };
+        unit_assert(T, lcm_process(L, b, c) == 0);
+        unit_assert(T, sink.bytes != NULL && strcmp(sink.bytes, "ACDE") == 0);
+    }
+    // Process batches of pure lambda twice, making sure that cached results are
+    // not passed to the lambda again.
+    {
+        const lcm_Batch bs[2] = {
+            {.lambda_id = 8, .data = {.bytes = (uint8_t*)"f", .length = 1 } },
+            {.lambda_id = 8, .data = {.bytes = (uint8_t*)"g", .length = 1 } },
+        };
+        unit_assert(T, lcm_processv(L, bs, cs, statuses, 2) == 2);
+        const lcm_Batch more[2] = {
+            bs[1],
+            {.lambda_id = 8, .data = {.bytes = (uint8_t*)"h", .length = 1 } },
+        };
+        unit_assert(T, lcm_processv(L, more, cs, statuses, 2) == 2);
+        unit_assert(T, sink.bytes != NULL
+                && strcmp(sink.bytes, "ACDEFGGH") == 0);
+    }
+    // Verify the number of calls made, and inputs passed.
+    {
+        lua_getglobal(L, "calls");
+        unit_assert(T, lua_tointeger(L, -1) == 5);
+        lua_getglobal(L, "inputs");
+        unit_assert(T, lua_tointeger(L, -1) == 8);
+        lua_pop(L, 2);
+    }
+    free(sink.bytes);
+}
+
+void test_profile(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM and register job keeping the CPU busy for a while.
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L, NULL);
+    }
+    const char* lua = "lcm:register(function (batch)\n"
+                      "  local t = os.clock()\n"
+                      "  while os.clock() - t < 0.02 do end\n"
+                      "  return batch\n"
+                      "end)";
+    const lcm_Lambda l = {
+        .lambda_id = 11,
+        .program = {.lua = (char*)lua, .length = strlen(lua) },
+    };
+    {
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+    // Profile batches, as well as Lua code running outside of any lambda.
+    Sink sink = {.bytes = NULL };
+    {
+        unit_assert(T, lcm_profstart(L, 1) == 0);
+
+        lcm_Batch result_batch = {.lambda_id = 0 };
+        const lcm_ClosureBatch c
+            = {.context = &result_batch, .function = f_batch };
+        const lcm_Batch b = {
+            .lambda_id = 11,
+            .data = {.bytes = (uint8_t*)"hello", .length = 5 },
+        };
+        for (int i = 0; i < 3; ++i) {
+            unit_assert(T, lcm_process(L, b, c) == 0);
+        }
+        const char* outside = "local t = os.clock()\n"
+                              "while os.clock() - t < 0.02 do end";
+        unit_assert(T,
+            luaL_loadbuffer(L, outside, strlen(outside), "=outside") == 0
+                && lua_pcall(L, 0, 0, 0) == 0);
+
+        const lcm_ClosureWrite w = {.context = &sink, .function = f_append };
+        unit_assert(T, lcm_profstop(L, w) == 0);
+        unit_assert(T, sink.bytes != NULL);
+    }
+    // Verify that every line holds a properly rooted stack and sample count.
+    {
+        size_t lambda = 0, frames = 0, outside = 0;
+        const char* line = sink.bytes != NULL ? sink.bytes : "";
+        for (const char* end; (end = strchr(line, '\n')) != NULL;
+             line = end + 1) {
+            const char* count = end;
+            while (count > line && count[-1] != ' ') {
+                count--;
+            }
+            if (count == line || count == end
+                || strspn(count, "0123456789") != (size_t)(end - count)) {
+                unit_failf(T, "Malformed line: %.*s", (int)(end - line), line);
+                continue;
+            }
+            if (strncmp(line, "lambda:11;", 10) == 0) {
+                lambda++;
+                const char* frame = strstr(line + 10, "lambda:11:");
+                frames += frame != NULL && frame < count;
+            } else if (strncmp(line, "[outside];", 10) == 0) {
+                outside++;
+            } else if (strncmp(line, "[dropped] ", 10) != 0) {
+                unit_failf(T, "Unexpected root: %.*s", (int)(end - line), line);
+            }
+        }
+        unit_assert(T, *line == '\0');
+        unit_assert(T, lambda > 0);
+        unit_assert(T, frames > 0);
+        unit_assert(T, outside > 0);
+    }
+    free(sink.bytes);
+}
+
+void test_trace(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM.
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L, NULL);
+    }
+    Sink sink = {.bytes = NULL };
+    const lcm_ClosureWrite w = {.context = &sink, .function = f_append };
+#ifndef LCM_USE_TRACE
+    unit_assert(T, lcm_trace(L, w) == LCM_ERRNOSUPPORT);
+    unit_skip(T, "Not compiled with LCM_USE_TRACE.");
+#else
+    // Register job and process batch.
+    const char* lua = "lcm:register(function (batch)\n"
+                      "  return batch\n"
+                      "end)";
+    const lcm_Lambda l = {
+        .lambda_id = 9,
+        .program = {.lua = (char*)lua, .length = strlen(lua) },
+    };
+    lcm_Batch result_batch = {.lambda_id = 0 };
+    const lcm_ClosureBatch c = {.context = &result_batch, .function = f_batch };
+    const lcm_Batch b = {
+        .lambda_id = 9,
+        .batch_id = 1,
+        .data = {.bytes = (uint8_t*)"hello", .length = 5 },
+    };
+    {
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+        unit_assert(T, lcm_process(L, b, c) == 0);
+    }
+    // Verify that trace is well-formed and contains all expected phases.
+    {
+        unit_assert(T, lcm_trace(L, w) == 0);
+        unit_assert(T, json_valid(sink.bytes));
+
+        const char* names[] = { "lookup", "load", "exec", "fetch", "push",
+            "pcall", "result", "callback" };
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+            char name[32];
+            snprintf(name, sizeof(name), "\"name\":\"%s\"", names[i]);
+            if (strstr(sink.bytes, name) == NULL) {
+                unit_failf(T, "Trace lacks %s event.", names[i]);
+            }
+        }
+        unit_assert(T, strstr(sink.bytes, "\"overwritten\":0}") != NULL);
+    }
+    // Overflow ring buffer and verify that overwritten events are reported.
+    {
+        for (int i = 0; i < LCM_TRACE_CAPACITY; ++i) {
+            lcm_process(L, b, c);
+        }
+        sink.length = 0;
+        unit_assert(T, lcm_trace(L, w) == 0);
+        unit_assert(T, json_valid(sink.bytes));
+        unit_assert(T, strstr(sink.bytes, "\"overwritten\":0}") == NULL);
+
+        // Overwrite count is reset once the trace has been written.
+        sink.length = 0;
+        unit_assert(T, lcm_trace(L, w) == 0);
+        unit_assert(T,
+            strcmp(sink.bytes,
+                "{\"traceEvents\":[],\"otherData\":{\"overwritten\":0}}")
+                == 0);
+    }
+    free(sink.bytes);
+#endif
+}
+
 static void f_log(void* context, const lcm_LogEntry* entry)
 {
     lcm_LogEntry* result = context;
@@ -179,6 +1520,41 @@ static void f_log(void* context, const lcm_LogEntry* entry)
     result->message.length = length;
 }
 
+static void f_log_batch(void* context, const lcm_LogEntry* entries,
+    size_t count, uint64_t dropped)
+{
+    lcm_LogEntry* results = context;
+
+    static char messages[3][64];
+
+    (void)dropped;
+
+    memset(results, 0, sizeof(lcm_LogEntry) * 4);
+    for (size_t i = 0; i < count && i < 3; ++i) {
+        const size_t length
+            = MIN(sizeof(messages[i]) - 1, entries[i].message.length);
+
+        results[i] = entries[i];
+        results[i].message.string
+            = memcpy(messages[i], entries[i].message.string, length);
+        results[i].message.length = length;
+    }
+}
+
+static void f_log_totals(void* context, const lcm_LogEntry* entries,
+    size_t count, uint64_t dropped)
+{
+    LogTotals* totals = context;
+    totals->deliveries++;
+    totals->entries += count;
+    totals->dropped += dropped;
+    for (size_t i = 0; i < count; ++i) {
+        if (entries[i].message.length > totals->longest) {
+            totals->longest = entries[i].message.length;
+        }
+    }
+}
+
 static void f_batch(void* context, const lcm_Batch* batch)
 {
     lcm_Batch* result = context;
@@ -190,6 +1566,176 @@ static void f_batch(void* context, const lcm_Batch* batch)
 
     result->lambda_id = batch->lambda_id;
     result->batch_id = batch->batch_id;
+    result->encoding = batch->encoding;
     result->data.bytes = memcpy(data, batch->data.bytes, length);
     result->data.length = length;
 }
+
+static void f_batch_nested(void* context, const lcm_Batch* batch)
+{
+    Nested* n = context;
+
+    const size_t length = MIN(sizeof(n->outer) - 1, batch->data.length);
+    if (batch->batch_id == 2) {
+        memcpy(n->inner, batch->data.bytes, length);
+        n->inner[length] = '\0';
+        return;
+    }
+    const lcm_Batch b = {
+        .lambda_id = batch->lambda_id,
+        .batch_id = 2,
+        .encoding = batch->encoding,
+        .data = {.bytes = (uint8_t*)"WORLD", .length = 5 },
+    };
+    n->status = lcm_process(n->L, b, (lcm_ClosureBatch){
+        .context = n,
+        .function = f_batch_nested,
+    });
+    memcpy(n->outer, batch->data.bytes, length);
+    n->outer[length] = '\0';
+}
+
+static void f_batch_append(void* context, const lcm_Batch* batch)
+{
+    f_append(context, batch->data.bytes, batch->data.length);
+}
+
+static size_t f_code(void* context, const uint8_t* in, size_t in_length,
+    uint8_t* out, size_t out_capacity)
+{
+    (void)context;
+
+    if (in_length <= out_capacity) {
+        for (size_t i = 0; i < in_length; ++i) {
+            out[i] = in[i] ^ 0x20;
+        }
+    }
+    return in_length;
+}
+
+static int f_write(void* context, const void* data, size_t length)
+{
+    Output* output = context;
+    if (length > sizeof(output->bytes) - output->length) {
+        return 1;
+    }
+    memcpy(&output->bytes[output->length], data, length);
+    output->length += length;
+    return 0;
+}
+
+static size_t f_read(void* context, void* data, size_t length)
+{
+    Input* input = context;
+    const size_t n = MIN(length, input->length - input->offset);
+    memcpy(data, &input->bytes[input->offset], n);
+    input->offset += n;
+    return n;
+}
+
+static int f_append(void* context, const void* data, size_t length)
+{
+    Sink* sink = context;
+    if (sink->length + length >= sink->capacity) {
+        size_t capacity = sink->capacity > 0 ? sink->capacity : 256;
+        while (sink->length + length >= capacity) {
+            capacity *= 2;
+        }
+        char* bytes = realloc(sink->bytes, capacity);
+        if (bytes == NULL) {
+            return 1;
+        }
+        sink->bytes = bytes;
+        sink->capacity = capacity;
+    }
+    memcpy(&sink->bytes[sink->length], data, length);
+    sink->length += length;
+    sink->bytes[sink->length] = '\0';
+    return 0;
+}
+
+#ifdef LCM_USE_TRACE
+// Skips JSON value at `*p`, returning `0` if it is malformed.
+static int json_value(const char** p)
+{
+    const char* s = *p + strspn(*p, " \t\r\n");
+    if (*s == '{' || *s == '[') {
+        const char close = *s == '{' ? '}' : ']';
+        s += 1 + strspn(s + 1, " \t\r\n");
+        if (*s == close) {
+            *p = s + 1;
+            return 1;
+        }
+        for (;;) {
+            if (close == '}') {
+                if (*s != '"' || !json_value(&s)) {
+                    return 0;
+                }
+                s += strspn(s, " \t\r\n");
+                if (*s++ != ':') {
+                    return 0;
+                }
+            }
+            if (!json_value(&s)) {
+                return 0;
+            }
+            s += strspn(s, " \t\r\n");
+            if (*s == close) {
+                *p = s + 1;
+                return 1;
+            }
+            if (*s++ != ',') {
+                return 0;
+            }
+            s += strspn(s, " \t\r\n");
+        }
+    }
+    if (*s == '"') {
+        for (++s; *s != '"'; ++s) {
+            if ((unsigned char)*s < 0x20 || (*s == '\\' && *++s == '\0')) {
+                return 0;
+            }
+        }
+        *p = s + 1;
+        return 1;
+    }
+    const char* literals[] = { "true", "false", "null" };
+    for (size_t i = 0; i < 3; ++i) {
+        if (strncmp(s, literals[i], strlen(literals[i])) == 0) {
+            *p = s + strlen(literals[i]);
+            return 1;
+        }
+    }
+    s += *s == '-';
+    size_t digits = strspn(s, "0123456789");
+    if (digits == 0) {
+        return 0;
+    }
+    s += digits;
+    if (*s == '.') {
+        digits = strspn(++s, "0123456789");
+        if (digits == 0) {
+            return 0;
+        }
+        s += digits;
+    }
+    if (*s == 'e' || *s == 'E') {
+        s += 1 + (s[1] == '+' || s[1] == '-');
+        digits = strspn(s, "0123456789");
+        if (digits == 0) {
+            return 0;
+        }
+        s += digits;
+    }
+    *p = s;
+    return 1;
+}
+
+static int json_valid(const char* json)
+{
+    if (json == NULL || !json_value(&json)) {
+        return 0;
+    }
+    return json[strspn(json, " \t\r\n")] == '\0';
+}
+#endif
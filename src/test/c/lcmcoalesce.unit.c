@@ -0,0 +1,252 @@
+#include "../../main/c/lcmcoalesce.h"
+#include "unit.h"
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+#include <string.h>
+
+void provider_lua_state(unit_T* T, unit_TestFunction t);
+
+//{ Test cases.
+void test_coalesce_groups(unit_T* T, void* arg);
+void test_coalesce_reentrant(unit_T* T, void* arg);
+void test_coalesce_tuning(unit_T* T, void* arg);
+//}
+
+void suite_lcmcoalesce(unit_T* T)
+{
+    unit_run_test(T, test_coalesce_groups, provider_lua_state);
+    unit_run_test(T, test_coalesce_reentrant, provider_lua_state);
+    unit_run_test(T, test_coalesce_tuning, provider_lua_state);
+}
+
+//{ Callbacks used by test cases.
+typedef struct {
+    lcm_Coalescer* co;
+    size_t results, resubmits, failures, errors;
+} Reentry;
+
+static void f_batch(void* context, const lcm_Batch* batch);
+static void f_reentry_batch(void* context, const lcm_Batch* batch);
+static void f_reentry_fail(void* context, const lcm_Batch* batch, int status);
+//}
+
+// Registers lambda returning its batch in upper case.
+static void register_upper(unit_T* T, lua_State* L, int32_t lambda_id)
+{
+    const char* lua = "lcm:register(function (batch)\n"
+                      "  return batch:upper()\n"
+                      "end)";
+    const lcm_Lambda l = {
+        .lambda_id = lambda_id,
+        .program = {.lua = (char*)lua, .length = strlen(lua) },
+    };
+    const int status = lcm_register(L, l);
+    if (status != 0) {
+        unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+    }
+}
+
+void test_coalesce_groups(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM.
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L, NULL);
+    }
+    // Register job.
+    {
+        const char* lua = "lcm:register(function (batch)\n"
+                          "  return batch:upper()\n"
+                          "end)";
+        const lcm_Lambda l = {
+            .lambda_id = 1,
+            .program = {.lua = (char*)lua, .length = strlen(lua) },
+        };
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+    // Create coalescer with a one second latency budget.
+    lcm_Coalescer* co = lcm_coalesce_new(
+        L, 4, 1000000000, (lcm_ClosureFail){.function = NULL });
+    if (co == NULL) {
+        unit_fatal(T, "Failed to create coalescer.");
+    }
+    // Submit batches. The first is processed at once, as the cost of
+    // processing is unknown, after which batches are held in groups.
+    size_t results = 0;
+    {
+        const lcm_ClosureBatch c = {.context = &results, .function = f_batch };
+        const lcm_Batch b = {
+            .lambda_id = 1,
+            .data = {.bytes = (uint8_t*)"x", .length = 1 },
+        };
+        unit_assert(T, lcm_coalesce_submit(co, b, c) == 0);
+        unit_assert(T, results == 1);
+        unit_assert(T, lcm_coalesce_target(co, 1) == 4);
+
+        unit_assert(T, lcm_coalesce_submit(co, b, c) == 0);
+        unit_assert(T, lcm_coalesce_submit(co, b, c) == 0);
+        unit_assert(T, lcm_coalesce_poll(co) == 0);
+        unit_assert(T, results == 1);
+    }
+    // Flush remaining batches.
+    {
+        unit_assert(T, lcm_coalesce_flush(co) == 2);
+        unit_assert(T, results == 3);
+    }
+    lcm_coalesce_free(co);
+}
+
+static void f_batch(void* context, const lcm_Batch* batch)
+{
+    size_t* results = context;
+    if (batch->data.length == 1 && batch->data.bytes[0] == 'X') {
+        (*results)++;
+    }
+}
+
+void test_coalesce_reentrant(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM and register job.
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L, NULL);
+        register_upper(T, L, 1);
+    }
+    // Create coalescer with a one second latency budget.
+    Reentry r = {.co = NULL };
+    r.co = lcm_coalesce_new(L, 4, 1000000000,
+        (lcm_ClosureFail){.context = &r, .function = f_reentry_fail });
+    if (r.co == NULL) {
+        unit_fatal(T, "Failed to create coalescer.");
+    }
+    const lcm_Batch b = {
+        .lambda_id = 1,
+        .data = {.bytes = (uint8_t*)"x", .length = 1 },
+    };
+    // Make target size of group grow to its maximum.
+    {
+        const lcm_ClosureBatch c
+            = {.context = &r.results, .function = f_batch };
+        unit_assert(T, lcm_coalesce_submit(r.co, b, c) == 0);
+        unit_assert(T, lcm_coalesce_target(r.co, 1) == 4);
+    }
+    // Fill group with batches whose closures submit more batches, both to the
+    // group being processed and to enough new groups to make them reallocate.
+    {
+        const lcm_ClosureBatch c
+            = {.context = &r, .function = f_reentry_batch };
+        for (size_t i = 0; i < 4; ++i) {
+            unit_assert(T, lcm_coalesce_submit(r.co, b, c) == 0);
+        }
+        unit_assert(T, r.resubmits == 4);
+        unit_assert(T, r.errors == 0);
+        unit_assert(T, r.results == 5);
+        unit_assert(T, r.failures == 12);
+        unit_assert(T, lcm_coalesce_flush(r.co) == 0);
+    }
+    lcm_coalesce_free(r.co);
+}
+
+void test_coalesce_tuning(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+
+    // Setup LCM and register two jobs.
+    {
+        luaL_openlibs(L);
+        lcm_openlib(L, NULL);
+        register_upper(T, L, 1);
+        register_upper(T, L, 2);
+    }
+    // Create coalescer with a one millisecond latency budget, and make the
+    // first job cheap and the second slow to process.
+    lcm_Coalescer* co
+        = lcm_coalesce_new(L, 8, 1000000, (lcm_ClosureFail){.function = NULL });
+    if (co == NULL) {
+        unit_fatal(T, "Failed to create coalescer.");
+    }
+    unit_assert(T, lcm_coalesce_estimate(co, 1, 1000) == 0);
+    unit_assert(T, lcm_coalesce_estimate(co, 2, 2000000) == 0);
+    unit_assert(T, lcm_coalesce_target(co, 1) == 8);
+    unit_assert(T, lcm_coalesce_target(co, 2) == 1);
+    size_t results = 0;
+    const lcm_ClosureBatch c = {.context = &results, .function = f_batch };
+
+    // Batches taking longer than the budget to process are never held.
+    {
+        const lcm_Batch b = {
+            .lambda_id = 2,
+            .data = {.bytes = (uint8_t*)"x", .length = 1 },
+        };
+        for (size_t i = 1; i <= 3; ++i) {
+            unit_assert(T, lcm_coalesce_submit(co, b, c) == 0);
+            unit_assert(T, results == i);
+            unit_assert(T, lcm_coalesce_target(co, 2) == 1);
+        }
+    }
+    // Batches that are cheap to process are held in groups of maximum size.
+    {
+        const lcm_Batch b = {
+            .lambda_id = 1,
+            .data = {.bytes = (uint8_t*)"x", .length = 1 },
+        };
+        for (size_t i = 0; i < 7; ++i) {
+            unit_assert(T, lcm_coalesce_submit(co, b, c) == 0);
+        }
+        unit_assert(T, results == 3);
+        unit_assert(T, lcm_coalesce_submit(co, b, c) == 0);
+        unit_assert(T, results == 11);
+        unit_assert(T, lcm_coalesce_target(co, 1) == 8);
+    }
+    // Clearing estimate makes the cost be measured again, which shows the
+    // second job to be as cheap as the first.
+    {
+        const lcm_Batch b = {
+            .lambda_id = 2,
+            .data = {.bytes = (uint8_t*)"x", .length = 1 },
+        };
+        unit_assert(T, lcm_coalesce_estimate(co, 2, 0) == 0);
+        unit_assert(T, lcm_coalesce_target(co, 2) == 1);
+        unit_assert(T, lcm_coalesce_submit(co, b, c) == 0);
+        unit_assert(T, results == 12);
+        unit_assert(T, lcm_coalesce_target(co, 2) == 8);
+    }
+    lcm_coalesce_free(co);
+}
+
+static void f_reentry_batch(void* context, const lcm_Batch* batch)
+{
+    Reentry* r = context;
+    const lcm_ClosureBatch c = {.context = &r->results, .function = f_batch };
+    lcm_Batch b = {
+        .lambda_id = batch->lambda_id,
+        .data = {.bytes = (uint8_t*)"x", .length = 1 },
+    };
+    r->resubmits++;
+    if (lcm_coalesce_submit(r->co, b, c) != 0) {
+        r->errors++;
+    }
+    // Lambdas not registered, failing as soon as processed.
+    for (int32_t i = 0; i < 3; ++i) {
+        b.lambda_id = 100 + (int32_t)r->resubmits * 3 + i;
+        if (lcm_coalesce_submit(r->co, b, c) != 0) {
+            r->errors++;
+        }
+    }
+}
+
+static void f_reentry_fail(void* context, const lcm_Batch* batch, int status)
+{
+    Reentry* r = context;
+    if (batch->lambda_id >= 100 && status == LCM_ERRNOLAMBDA) {
+        r->failures++;
+    }
+}
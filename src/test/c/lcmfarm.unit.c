@@ -0,0 +1,394 @@
+#include "../../main/c/lcmfarm.h"
+#include "../../main/c/lcmtime.h"
+#include "unit.h"
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/** Program executed by farms under test, which is the test program itself. */
+#define WORKER_PATH "/proc/self/exe"
+
+//{ Test cases.
+void test_farm_batches(unit_T* T, void* arg);
+void test_farm_corrupt(unit_T* T, void* arg);
+void test_farm_crash(unit_T* T, void* arg);
+void test_farm_failed(unit_T* T, void* arg);
+//}
+
+void suite_lcmfarm(unit_T* T)
+{
+#ifdef __linux__
+    unit_run_test(T, test_farm_batches, NULL);
+    unit_run_test(T, test_farm_corrupt, NULL);
+    unit_run_test(T, test_farm_crash, NULL);
+    unit_run_test(T, test_farm_failed, NULL);
+#else
+    (void)T;
+#endif
+}
+
+#ifdef __linux__
+//{ Shared memory layout of farms, mirrored to let workers corrupt it.
+typedef struct {
+    uint64_t head, tail;
+    uint32_t signals[4];
+} Ring;
+
+typedef struct {
+    uint32_t magic, workers, ring_size, padding;
+    uint32_t results[2];
+    struct {
+        Ring requests, responses;
+    } channels[];
+} Shared;
+
+typedef struct {
+    uint32_t size, type;
+    int32_t lambda_id, batch_id, value;
+    uint32_t length;
+} Message;
+//}
+
+static int worker_fd;
+static size_t worker_index;
+
+// Writes invalid response of `kind` to response ring of worker, as would a
+// faulty worker.
+static int l_corrupt(lua_State* L)
+{
+    static const Message messages[] = {
+        {.size = 3, .type = 4 }, // Unaligned.
+        {.size = 8, .type = 4 }, // Smaller than header.
+        {.size = 8192, .type = 4 }, // Larger than ring.
+        {.size = 32, .type = 4, .length = 100 }, // Payload larger than size.
+    };
+    const lua_Integer kind = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, kind >= 1 && kind <= 4, 1, "invalid kind");
+
+    struct stat st;
+    if (fstat(worker_fd, &st) != 0) {
+        return luaL_error(L, "fstat failed");
+    }
+    void* p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED, worker_fd, 0);
+    if (p == MAP_FAILED) {
+        return luaL_error(L, "mmap failed");
+    }
+    Shared* shared = p;
+    Ring* r = &shared->channels[worker_index].responses;
+    uint8_t* data = (uint8_t*)&shared->channels[shared->workers]
+        + (worker_index * 2 + 1) * shared->ring_size;
+    const uint64_t head = __atomic_load_n(&r->head, __ATOMIC_SEQ_CST);
+    uint8_t* m = &data[head % shared->ring_size];
+    memset(m, 0, 32);
+    memcpy(m, &messages[kind - 1], sizeof(Message));
+    __atomic_store_n(&r->head, head + 32, __ATOMIC_SEQ_CST);
+    munmap(p, (size_t)st.st_size);
+    return 0;
+}
+#endif
+
+int farm_worker(const char* fd, const char* index)
+{
+    lua_State* L = luaL_newstate();
+    if (L == NULL) {
+        return 1;
+    }
+    luaL_openlibs(L);
+    lcm_openlib(L, NULL);
+#ifdef __linux__
+    worker_fd = atoi(fd);
+    worker_index = (size_t)strtoul(index, NULL, 10);
+    lua_pushcfunction(L, l_corrupt);
+    lua_setglobal(L, "corrupt");
+#endif
+    lcm_farm_serve(L, atoi(fd), (size_t)strtoul(index, NULL, 10));
+    lua_close(L);
+    return 1;
+}
+
+//{ Callbacks used by test cases.
+typedef struct {
+    size_t results, failures, crashes;
+    int32_t batch_ids;
+} Outcome;
+
+static void f_batch(void* context, const lcm_Batch* batch);
+static void f_fail(void* context, const lcm_Batch* batch, int status);
+//}
+
+// Registers lambda with farm, padding its program with a comment of `padding`
+// bytes.
+static void register_lambda(unit_T* T, lcm_Farm* f, int32_t lambda_id,
+    const char* lua, size_t padding)
+{
+    char program[1024];
+    const size_t length = strlen(lua);
+    if (length + padding + 3 > sizeof(program)) {
+        unit_fatal(T, "Lambda program too long.");
+    }
+    memcpy(program, lua, length);
+    memcpy(&program[length], "\n--", 3);
+    memset(&program[length + 3], '-', padding);
+
+    const lcm_Lambda l = {
+        .lambda_id = lambda_id,
+        .program = {.lua = program, .length = length + 3 + padding },
+    };
+    const int status = lcm_farm_register(f, l);
+    if (status != 0) {
+        unit_failf(T, "[lcm_farm_register] %s", lcm_errstr(status));
+    }
+}
+
+// Waits for at most one second for all batches in flight to complete.
+static void wait_all(unit_T* T, lcm_Farm* f)
+{
+    const uint64_t end = lcm_time_now() + 1000000000;
+    while (lcm_farm_count(f) > 0 && lcm_time_now() < end) {
+        lcm_farm_wait(f, 10000000);
+    }
+    if (lcm_farm_count(f) > 0) {
+        unit_failf(T, "%zu batches never completed.", lcm_farm_count(f));
+    }
+}
+
+void test_farm_batches(unit_T* T, void* arg)
+{
+    (void)arg;
+
+    Outcome o = {.results = 0 };
+    lcm_Farm* f = lcm_farm_new(WORKER_PATH, 2, 4096,
+        (lcm_ClosureFail){.context = &o, .function = f_fail });
+    if (f == NULL) {
+        unit_fatal(T, "Failed to create farm.");
+    }
+    register_lambda(T, f, 1,
+        "lcm:register(function (batch)\n"
+        "  return batch:upper()\n"
+        "end)",
+        0);
+
+    // Submit batches, both copied and written directly to shared memory.
+    const lcm_ClosureBatch c = {.context = &o, .function = f_batch };
+    for (int32_t i = 0; i < 8; ++i) {
+        const lcm_Batch b = {
+            .lambda_id = 1,
+            .batch_id = i,
+            .data = {.bytes = (uint8_t*)"x", .length = 1 },
+        };
+        unit_assert(T, lcm_farm_submit(f, b, c) == 0);
+    }
+    {
+        uint8_t* bytes = lcm_farm_alloc(f, 1);
+        unit_assert(T, bytes != NULL);
+        bytes[0] = 'x';
+        const lcm_Batch b = {
+            .lambda_id = 1,
+            .batch_id = 8,
+            .data = {.bytes = bytes, .length = 1 },
+        };
+        unit_assert(T, lcm_farm_submit(f, b, c) == 0);
+    }
+    unit_assert(T, lcm_farm_count(f) == 9);
+
+    wait_all(T, f);
+    unit_assert(T, o.results == 9);
+    unit_assert(T, o.batch_ids == 0x1ff);
+    unit_assert(T, o.failures == 0);
+    unit_assert(T, lcm_farm_restarts(f) == 0);
+
+    lcm_farm_free(f);
+}
+
+// Submits batch, waiting for at most one second for a restarted worker to
+// accept it.
+static void submit(unit_T* T, lcm_Farm* f, const lcm_Batch b, Outcome* o)
+{
+    const lcm_ClosureBatch c = {.context = o, .function = f_batch };
+    const uint64_t end = lcm_time_now() + 1000000000;
+    int status;
+    while ((status = lcm_farm_submit(f, b, c)) == LCM_ERRFULL
+        && lcm_time_now() < end) {
+        lcm_farm_wait(f, 1000000);
+    }
+    if (status != 0) {
+        unit_failf(T, "[lcm_farm_submit] %s", lcm_errstr(status));
+    }
+}
+
+void test_farm_corrupt(unit_T* T, void* arg)
+{
+    (void)arg;
+
+    Outcome o = {.results = 0 };
+    lcm_Farm* f = lcm_farm_new(WORKER_PATH, 1, 4096,
+        (lcm_ClosureFail){.context = &o, .function = f_fail });
+    if (f == NULL) {
+        unit_fatal(T, "Failed to create farm.");
+    }
+    register_lambda(T, f, 1,
+        "lcm:register(function (batch)\n"
+        "  corrupt(tonumber(batch))\n"
+        "  return batch\n"
+        "end)",
+        0);
+    register_lambda(T, f, 2,
+        "lcm:register(function (batch)\n"
+        "  return batch:upper()\n"
+        "end)",
+        0);
+
+    // Every kind of invalid response header makes worker be restarted.
+    static const char* kinds = "1234";
+    for (int32_t i = 0; i < 4; ++i) {
+        const lcm_Batch b = {
+            .lambda_id = 1,
+            .batch_id = i,
+            .data = {.bytes = (uint8_t*)&kinds[i], .length = 1 },
+        };
+        submit(T, f, b, &o);
+        wait_all(T, f);
+        unit_assert(T, o.crashes == (size_t)i + 1);
+        unit_assert(T, lcm_farm_restarts(f) == (uint64_t)i + 1);
+    }
+    unit_assert(T, o.results == 0);
+    unit_assert(T, o.failures == 4);
+    unit_assert(T, lcm_farm_failed(f) == 0);
+
+    // Restarted worker still processes batches.
+    {
+        const lcm_Batch b = {
+            .lambda_id = 2,
+            .batch_id = 4,
+            .data = {.bytes = (uint8_t*)"x", .length = 1 },
+        };
+        submit(T, f, b, &o);
+        wait_all(T, f);
+        unit_assert(T, o.results == 1);
+        unit_assert(T, o.batch_ids == 1 << 4);
+    }
+    lcm_farm_free(f);
+}
+
+void test_farm_crash(unit_T* T, void* arg)
+{
+    (void)arg;
+
+    // Rings are made too small for the worker to be sent both lambdas at
+    // once, making it resend lambdas over several polls when restarted.
+    Outcome o = {.results = 0 };
+    lcm_Farm* f = lcm_farm_new(WORKER_PATH, 1, 1024,
+        (lcm_ClosureFail){.context = &o, .function = f_fail });
+    if (f == NULL) {
+        unit_fatal(T, "Failed to create farm.");
+    }
+    register_lambda(T, f, 1,
+        "lcm:register(function (batch)\n"
+        "  os.exit(1)\n"
+        "end)",
+        600);
+    register_lambda(T, f, 2,
+        "lcm:register(function (batch)\n"
+        "  return batch:upper()\n"
+        "end)",
+        600);
+
+    // Make worker exit while batches are in flight.
+    const lcm_ClosureBatch c = {.context = &o, .function = f_batch };
+    {
+        lcm_Batch b = {
+            .lambda_id = 1,
+            .batch_id = 0,
+            .data = {.bytes = (uint8_t*)"x", .length = 1 },
+        };
+        unit_assert(T, lcm_farm_submit(f, b, c) == 0);
+        b.lambda_id = 2;
+        b.batch_id = 1;
+        unit_assert(T, lcm_farm_submit(f, b, c) == 0);
+
+        wait_all(T, f);
+        unit_assert(T, o.results == 0);
+        unit_assert(T, o.crashes == 2);
+        unit_assert(T, lcm_farm_restarts(f) == 1);
+    }
+    // Batches are accepted by restarted worker after all lambdas have been
+    // registered again.
+    {
+        const lcm_Batch b = {
+            .lambda_id = 2,
+            .batch_id = 2,
+            .data = {.bytes = (uint8_t*)"x", .length = 1 },
+        };
+        const uint64_t end = lcm_time_now() + 1000000000;
+        int status;
+        while ((status = lcm_farm_submit(f, b, c)) == LCM_ERRFULL
+            && lcm_time_now() < end) {
+            lcm_farm_wait(f, 1000000);
+        }
+        unit_assert(T, status == 0);
+
+        wait_all(T, f);
+        unit_assert(T, o.results == 1);
+        unit_assert(T, o.batch_ids == 1 << 2);
+        unit_assert(T, o.failures == 2);
+    }
+    lcm_farm_free(f);
+}
+
+void test_farm_failed(unit_T* T, void* arg)
+{
+    (void)arg;
+
+    // Worker program exiting at once, without responding.
+    lcm_Farm* f = lcm_farm_new(
+        "/bin/false", 1, 1024, (lcm_ClosureFail){.function = NULL });
+    if (f == NULL) {
+        unit_skip(T, "No `/bin/false` program available.");
+    }
+    const uint64_t end = lcm_time_now() + 5000000000;
+    while (lcm_farm_failed(f) == 0 && lcm_time_now() < end) {
+        lcm_farm_wait(f, 10000000);
+    }
+    unit_assert(T, lcm_farm_failed(f) == 1);
+    unit_assert(T, lcm_farm_restarts(f) == 8);
+    {
+        const lcm_Batch b = {.lambda_id = 1 };
+        const lcm_ClosureBatch c = {.function = f_batch };
+        unit_assert(T, lcm_farm_submit(f, b, c) == LCM_ERRCRASH);
+    }
+    {
+        const lcm_Lambda l = {
+            .lambda_id = 1,
+            .program = {.lua = "", .length = 0 },
+        };
+        unit_assert(T, lcm_farm_register(f, l) == LCM_ERRCRASH);
+    }
+    lcm_farm_free(f);
+}
+
+static void f_batch(void* context, const lcm_Batch* batch)
+{
+    Outcome* o = context;
+    if (batch->data.length == 1 && batch->data.bytes[0] == 'X') {
+        o->results++;
+        o->batch_ids |= 1 << batch->batch_id;
+    }
+}
+
+static void f_fail(void* context, const lcm_Batch* batch, int status)
+{
+    (void)batch;
+    Outcome* o = context;
+    o->failures++;
+    if (status == LCM_ERRCRASH) {
+        o->crashes++;
+    }
+}
@@ -0,0 +1,295 @@
+#include "../../main/c/lcmsched.h"
+#include "../../main/c/lcmtime.h"
+#include "unit.h"
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+#include <string.h>
+
+void provider_lua_state(unit_T* T, unit_TestFunction t);
+
+//{ Test cases.
+void test_sched_deadline(unit_T* T, void* arg);
+void test_sched_order(unit_T* T, void* arg);
+void test_sched_times(unit_T* T, void* arg);
+void test_sched_weight(unit_T* T, void* arg);
+//}
+
+void suite_lcmsched(unit_T* T)
+{
+    unit_run_test(T, test_sched_deadline, provider_lua_state);
+    unit_run_test(T, test_sched_order, provider_lua_state);
+    unit_run_test(T, test_sched_times, provider_lua_state);
+    unit_run_test(T, test_sched_weight, provider_lua_state);
+}
+
+//{ Callbacks used by test cases.
+static void f_batch(void* context, const lcm_Batch* batch);
+static void f_report(void* context, const lcm_SchedReport* report);
+//}
+
+/** Records IDs of processed batches and reports of batches. */
+typedef struct {
+    int32_t batch_ids[16];
+    size_t batch_count;
+    int statuses[16];
+    lcm_SchedReport reports[16];
+    size_t report_count;
+} Record;
+
+// Sets up LCM and registers lambdas 1 and 2, both returning their batches.
+static void setup(unit_T* T, lua_State* L)
+{
+    luaL_openlibs(L);
+    lcm_openlib(L, NULL);
+
+    const char* lua = "lcm:register(function (batch)\n"
+                      "  return batch\n"
+                      "end)";
+    for (int32_t lambda_id = 1; lambda_id <= 2; ++lambda_id) {
+        const lcm_Lambda l = {
+            .lambda_id = lambda_id,
+            .program = {.lua = (char*)lua, .length = strlen(lua) },
+        };
+        const int status = lcm_register(L, l);
+        if (status != 0) {
+            unit_failf(T, "[lcm_register] %s", lcm_errstr(status));
+        }
+    }
+}
+
+// Creates scheduler able to hold `capacity` batches, reporting to `record`.
+static lcm_Scheduler* sched_new(unit_T* T, size_t capacity, Record* record)
+{
+    lcm_Scheduler* s = lcm_sched_new(capacity,
+        (lcm_ClosureReport){
+            .context = record,
+            .function = f_report,
+        });
+    if (s == NULL) {
+        unit_fatal(T, "Failed to create scheduler.");
+    }
+    return s;
+}
+
+void test_sched_deadline(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+    setup(T, L);
+
+    // Queue batches with and without deadlines, in two classes.
+    Record record = {.batch_count = 0 };
+    lcm_Scheduler* s = sched_new(T, 8, &record);
+    {
+        const lcm_ClosureBatch c = {.context = &record, .function = f_batch };
+        lcm_Batch b = {
+            .lambda_id = 1,
+            .data = {.bytes = (uint8_t*)"x", .length = 1 },
+        };
+        const struct {
+            int32_t batch_id;
+            int priority;
+            uint64_t deadline;
+        } submits[] = {
+            { 1, LCM_PRIORITY_NORMAL, 0 },
+            { 2, LCM_PRIORITY_NORMAL, 3000000000 },
+            { 3, LCM_PRIORITY_BULK, 1000000000 },
+            { 4, LCM_PRIORITY_NORMAL, 1000000000 },
+            { 5, LCM_PRIORITY_NORMAL, 2000000000 },
+            { 6, LCM_PRIORITY_NORMAL, 0 },
+        };
+        for (size_t i = 0; i < sizeof(submits) / sizeof(submits[0]); ++i) {
+            b.lambda_id = 1 + (int32_t)(i % 2);
+            b.batch_id = submits[i].batch_id;
+            unit_assert(T,
+                lcm_sched_submit(
+                    s, b, submits[i].priority, submits[i].deadline, c)
+                    == 0);
+        }
+    }
+    // Within a class, batches are processed earliest deadline first, and
+    // before batches without deadlines.
+    {
+        unit_assert(T, lcm_sched_run(s, L, 10) == 6);
+        unit_assert(T, record.batch_count == 6);
+        const int32_t expected[] = { 4, 5, 2, 1, 6, 3 };
+        for (size_t i = 0; i < 6; ++i) {
+            unit_assert(T, record.batch_ids[i] == expected[i]);
+            unit_assert(T, record.statuses[i] == 0);
+        }
+    }
+    lcm_sched_free(s);
+}
+
+void test_sched_order(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+    setup(T, L);
+    // Queue batches of different priorities, one with an expired deadline.
+    Record record = {.batch_count = 0 };
+    lcm_Scheduler* s = sched_new(T, 3, &record);
+    {
+        const lcm_ClosureBatch c = {.context = &record, .function = f_batch };
+        lcm_Batch b = {
+            .lambda_id = 1,
+            .data = {.bytes = (uint8_t*)"x", .length = 1 },
+        };
+        b.batch_id = 1;
+        unit_assert(T, lcm_sched_submit(s, b, LCM_PRIORITY_BULK, 0, c) == 0);
+        b.batch_id = 2;
+        unit_assert(T,
+            lcm_sched_submit(s, b, LCM_PRIORITY_INTERACTIVE, 1, c) == 0);
+        b.batch_id = 3;
+        unit_assert(T,
+            lcm_sched_submit(s, b, LCM_PRIORITY_INTERACTIVE, 0, c) == 0);
+        b.batch_id = 4;
+        unit_assert(T,
+            lcm_sched_submit(s, b, LCM_PRIORITY_NORMAL, 0, c) == LCM_ERRFULL);
+    }
+    // Process batches and verify order.
+    {
+        unit_assert(T, lcm_sched_run(s, L, 10) == 3);
+        unit_assert(T, lcm_sched_count(s) == 0);
+
+        unit_assert(T, record.report_count == 3);
+        unit_assert(T, record.statuses[0] == LCM_ERREXPIRED);
+        unit_assert(T, record.statuses[1] == 0);
+        unit_assert(T, record.statuses[2] == 0);
+
+        unit_assert(T, record.batch_count == 2);
+        unit_assert(T, record.batch_ids[0] == 3);
+        unit_assert(T, record.batch_ids[1] == 1);
+    }
+    lcm_sched_free(s);
+}
+
+void test_sched_times(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+    setup(T, L);
+
+    // Queue batches, one with an expired deadline.
+    Record record = {.batch_count = 0 };
+    lcm_Scheduler* s = sched_new(T, 4, &record);
+    const uint64_t start = lcm_time_now();
+    {
+        const lcm_ClosureBatch c = {.context = &record, .function = f_batch };
+        lcm_Batch b = {
+            .lambda_id = 1,
+            .data = {.bytes = (uint8_t*)"x", .length = 1 },
+        };
+        b.batch_id = 1;
+        unit_assert(T, lcm_sched_submit(s, b, LCM_PRIORITY_NORMAL, 1, c) == 0);
+        for (int32_t i = 2; i <= 4; ++i) {
+            b.batch_id = i;
+            unit_assert(
+                T, lcm_sched_submit(s, b, LCM_PRIORITY_NORMAL, 0, c) == 0);
+        }
+    }
+    // Dropped batches are only queued, while each processed batch is queued
+    // for at least as long as the batches processed before it were executed.
+    {
+        unit_assert(T, lcm_sched_run(s, L, 10) == 4);
+        const uint64_t elapsed = lcm_time_now() - start;
+
+        unit_assert(T, record.report_count == 4);
+        const lcm_SchedReport* r = record.reports;
+        unit_assert(T, r[0].batch_id == 1);
+        unit_assert(T, r[0].status == LCM_ERREXPIRED);
+        unit_assert(T, r[0].exec_time == 0);
+        unit_assert(T, r[0].queue_time > 0);
+
+        uint64_t executed = 0;
+        for (size_t i = 1; i < 4; ++i) {
+            unit_assert(T, r[i].status == 0);
+            unit_assert(T, r[i].exec_time > 0);
+            unit_assert(T, r[i].queue_time >= executed);
+            unit_assert(T, r[i].queue_time + r[i].exec_time <= elapsed);
+            executed += r[i].exec_time;
+        }
+    }
+    lcm_sched_free(s);
+}
+
+void test_sched_weight(unit_T* T, void* arg)
+{
+    lua_State* L = arg;
+    setup(T, L);
+
+    Record record = {.batch_count = 0 };
+    lcm_Scheduler* s = sched_new(T, 16, &record);
+    const lcm_ClosureBatch c = {.context = &record, .function = f_batch };
+
+    // Lambdas sharing a class are given processing in proportion to their
+    // weights.
+    {
+        unit_assert(T, lcm_sched_weight(s, 1, 3) == 0);
+        for (int32_t i = 0; i < 8; ++i) {
+            for (int32_t lambda_id = 1; lambda_id <= 2; ++lambda_id) {
+                const lcm_Batch b = {
+                    .lambda_id = lambda_id,
+                    .batch_id = lambda_id,
+                    .data = {.bytes = (uint8_t*)"x", .length = 1 },
+                };
+                unit_assert(
+                    T, lcm_sched_submit(s, b, LCM_PRIORITY_NORMAL, 0, c) == 0);
+            }
+        }
+        unit_assert(T, lcm_sched_run(s, L, 8) == 8);
+        size_t counts[3] = { 0 };
+        for (size_t i = 0; i < record.batch_count; ++i) {
+            counts[record.batch_ids[i]]++;
+        }
+        unit_assert(T, counts[1] == 6);
+        unit_assert(T, counts[2] == 2);
+
+        unit_assert(T, lcm_sched_run(s, L, 10) == 8);
+        unit_assert(T, lcm_sched_weight(s, 1, 1) == 0);
+    }
+    // Batches of one class do not reduce the share of their lambda in another.
+    {
+        record.batch_count = 0;
+        for (int32_t i = 0; i < 8; ++i) {
+            const lcm_Batch b = {
+                .lambda_id = 1,
+                .batch_id = 3,
+                .data = {.bytes = (uint8_t*)"x", .length = 1 },
+            };
+            unit_assert(
+                T, lcm_sched_submit(s, b, LCM_PRIORITY_BULK, 0, c) == 0);
+        }
+        for (int32_t i = 0; i < 2; ++i) {
+            for (int32_t lambda_id = 1; lambda_id <= 2; ++lambda_id) {
+                const lcm_Batch b = {
+                    .lambda_id = lambda_id,
+                    .batch_id = lambda_id,
+                    .data = {.bytes = (uint8_t*)"x", .length = 1 },
+                };
+                unit_assert(
+                    T, lcm_sched_submit(s, b, LCM_PRIORITY_NORMAL, 0, c) == 0);
+            }
+        }
+        unit_assert(T, lcm_sched_run(s, L, 2) == 2);
+        unit_assert(T, record.batch_count == 2);
+        unit_assert(T, record.batch_ids[0] == 1);
+        unit_assert(T, record.batch_ids[1] == 2);
+    }
+    lcm_sched_free(s);
+}
+
+static void f_batch(void* context, const lcm_Batch* batch)
+{
+    Record* record = context;
+    if (record->batch_count < 16) {
+        record->batch_ids[record->batch_count++] = batch->batch_id;
+    }
+}
+
+static void f_report(void* context, const lcm_SchedReport* report)
+{
+    Record* record = context;
+    if (record->report_count < 16) {
+        record->reports[record->report_count] = *report;
+        record->statuses[record->report_count++] = report->status;
+    }
+}
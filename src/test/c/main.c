@@ -2,14 +2,26 @@
 
 // Test suite function prototypes.
 void suite_lcm(unit_T* T);
+void suite_lcmcoalesce(unit_T* T);
+void suite_lcmfarm(unit_T* T);
+void suite_lcmsched(unit_T* T);
 
-int main()
+// Farm worker entry point, used when executed by farms under test.
+int farm_worker(const char* fd, const char* index);
+
+int main(int argc, char** argv)
 {
+    if (argc == 3) {
+        return farm_worker(argv[1], argv[2]);
+    }
     unit_State u;
     unit_init(&u);
 
     // Test suite invocations.
     unit_run_suite(&u, "lcm", suite_lcm);
+    unit_run_suite(&u, "lcmcoalesce", suite_lcmcoalesce);
+    unit_run_suite(&u, "lcmfarm", suite_lcmfarm);
+    unit_run_suite(&u, "lcmsched", suite_lcmsched);
 
     unit_exit(&u);
 }
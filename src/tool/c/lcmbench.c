@@ -0,0 +1,177 @@
+/**
+ * Lua/compute batch processing benchmark tool.
+ *
+ * Processes the same number of tiny batches three times: once per call to
+ * `lcm_process()`, in groups passed to `lcm_processv()`, and in groups passed
+ * to `lcm_processv()` with a lambda registered with `LCM_LAMBDA_FVECTOR`. The
+ * average time spent on each batch is then reported for every run, together
+ * with its speedup over the first.
+ *
+ * Usage: lcmbench [-n <batch count>] [-g <group size>]
+ *
+ * @file
+ */
+#include "../../main/c/lcm.h"
+#include "../../main/c/lcmtime.h"
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LAMBDA_SCALAR 1
+#define LAMBDA_VECTOR 2
+
+static int register_lambda(
+    lua_State* L, int32_t lambda_id, uint32_t flags, const char* lua);
+static uint64_t run_single(lua_State* L, int32_t lambda_id, size_t count);
+static uint64_t run_grouped(lua_State* L, int32_t lambda_id, size_t count,
+    lcm_Batch* bs, lcm_ClosureBatch* cs, size_t group);
+static void count_result(void* context, const lcm_Batch* result);
+
+int main(int argc, char** argv)
+{
+    size_t count = 1000000, group = 64;
+    int i = 1;
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if (strcmp(argv[i], "-n") == 0) {
+            count = (size_t)strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-g") == 0) {
+            group = (size_t)strtoul(argv[i + 1], NULL, 10);
+        } else {
+            break;
+        }
+    }
+    if (i != argc || count == 0 || group == 0) {
+        fprintf(stderr,
+            "Usage: %s [-n <batch count>] [-g <group size>]\n"
+            "  -n  Number of batches processed by each run.\n"
+            "  -g  Number of batches passed to each lcm_processv() call.\n",
+            argv[0]);
+        return 2;
+    }
+    lcm_Batch* bs = malloc(group * sizeof(lcm_Batch));
+    lcm_ClosureBatch* cs = malloc(group * sizeof(lcm_ClosureBatch));
+    if (bs == NULL || cs == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+    lua_State* L = luaL_newstate();
+    if (L == NULL) {
+        fprintf(stderr, "Failed to create Lua state.\n");
+        return 1;
+    }
+    luaL_openlibs(L);
+    lcm_openlib(L, NULL);
+    if (register_lambda(L, LAMBDA_SCALAR, 0,
+            "lcm:register(function (batch)\n"
+            "  return batch\n"
+            "end)")
+            != 0
+        || register_lambda(L, LAMBDA_VECTOR, LCM_LAMBDA_FVECTOR,
+               "lcm:register(function (batches)\n"
+               "  return batches\n"
+               "end)")
+            != 0) {
+        return 1;
+    }
+
+    // Warm up, and then time each run.
+    run_single(L, LAMBDA_SCALAR, count / 10 + 1);
+    run_grouped(L, LAMBDA_VECTOR, count / 10 + 1, bs, cs, group);
+    const uint64_t single = run_single(L, LAMBDA_SCALAR, count);
+    const uint64_t grouped
+        = run_grouped(L, LAMBDA_SCALAR, count, bs, cs, group);
+    const uint64_t vector = run_grouped(L, LAMBDA_VECTOR, count, bs, cs, group);
+
+    printf("Processed %zu batches per run, in groups of %zu.\n\n", count,
+        group);
+    printf("%-28s %12s %9s\n", "", "ns/batch", "speedup");
+    printf("%-28s %12.1f %8.2fx\n", "lcm_process()",
+        (double)single / count, 1.0);
+    printf("%-28s %12.1f %8.2fx\n", "lcm_processv()",
+        (double)grouped / count, (double)single / grouped);
+    printf("%-28s %12.1f %8.2fx\n", "lcm_processv(), vector",
+        (double)vector / count, (double)single / vector);
+
+    lua_close(L);
+    free(cs);
+    free(bs);
+    return 0;
+}
+
+static int register_lambda(
+    lua_State* L, int32_t lambda_id, uint32_t flags, const char* lua)
+{
+    const lcm_Lambda l = {
+        .lambda_id = lambda_id,
+        .flags = flags,
+        .program = {.lua = (char*)lua, .length = strlen(lua) },
+    };
+    const int status = lcm_register(L, l);
+    if (status != 0) {
+        fprintf(stderr, "Lambda %d: %s\n", (int)lambda_id, lcm_errstr(status));
+    }
+    return status;
+}
+
+// Processes `count` batches, one per call, and returns the time it took.
+static uint64_t run_single(lua_State* L, int32_t lambda_id, size_t count)
+{
+    size_t results = 0;
+    const lcm_ClosureBatch c = {.context = &results, .function = count_result };
+    lcm_Batch b = {
+        .lambda_id = lambda_id,
+        .data = {.bytes = (uint8_t*)"x", .length = 1 },
+    };
+    const uint64_t start = lcm_time_now();
+    for (size_t i = 0; i < count; ++i) {
+        b.batch_id = (int32_t)i;
+        lcm_process(L, b, c);
+    }
+    const uint64_t duration = lcm_time_now() - start;
+    if (results != count) {
+        fprintf(stderr, "%zu of %zu batches failed.\n", count - results,
+            count);
+    }
+    return duration;
+}
+
+// Processes `count` batches, in groups of `group`, and returns the time it
+// took.
+static uint64_t run_grouped(lua_State* L, int32_t lambda_id, size_t count,
+    lcm_Batch* bs, lcm_ClosureBatch* cs, size_t group)
+{
+    size_t results = 0;
+    for (size_t i = 0; i < group; ++i) {
+        bs[i] = (lcm_Batch){
+            .lambda_id = lambda_id,
+            .data = {.bytes = (uint8_t*)"x", .length = 1 },
+        };
+        cs[i] = (lcm_ClosureBatch){
+            .context = &results,
+            .function = count_result,
+        };
+    }
+    const uint64_t start = lcm_time_now();
+    for (size_t i = 0; i < count; i += group) {
+        const size_t n = count - i < group ? count - i : group;
+        for (size_t j = 0; j < n; ++j) {
+            bs[j].batch_id = (int32_t)(i + j);
+        }
+        lcm_processv(L, bs, cs, NULL, n);
+    }
+    const uint64_t duration = lcm_time_now() - start;
+    if (results != count) {
+        fprintf(stderr, "%zu of %zu batches failed.\n", count - results,
+            count);
+    }
+    return duration;
+}
+
+static void count_result(void* context, const lcm_Batch* result)
+{
+    (void)result;
+    (*(size_t*)context)++;
+}
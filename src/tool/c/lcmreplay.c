@@ -0,0 +1,338 @@
+/**
+ * Lua/compute capture replay tool.
+ *
+ * Registers the lambdas of a capture file, written via the `capture` closure of
+ * `lcm_Config`, and processes its batches in the order they were captured,
+ * either as fast as possible or at the pace they were originally submitted.
+ * The throughput and latencies of the replay are then reported alongside
+ * those of the capture, optionally followed by the hardware performance
+ * counters of each lambda.
+ *
+ * Usage: lcmreplay [-o] [-p] [-c <cache capacity>] <capture file>
+ *
+ * Exits with status `1` if the capture cannot be read or contains batches,
+ * including warmup batches of lambdas, that are not `LCM_ENCODING_RAW`, as the
+ * codecs needed to decode them are not known to the tool. Exits with status
+ * `3` if any batch produced a different status code when replayed than when
+ * captured.
+ *
+ * @file
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include "../../main/c/lcm.h"
+#include "../../main/c/lcmcapture.h"
+#include "../../main/c/lcmtime.h"
+#include <inttypes.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** Latencies of a set of processed batches, in nanoseconds. */
+typedef struct {
+    uint64_t* values;
+    size_t count;
+    uint64_t total;
+} Latencies;
+
+static int read_file(const char* path, uint8_t** data, size_t* length);
+static void wait_until(uint64_t t);
+static void discard(void* context, const lcm_Batch* result);
+static int compare(const void* a, const void* b);
+static uint64_t percentile(const Latencies* l, unsigned p);
+static void report(const char* name, double captured, double replayed);
+static void report_perf(lua_State* L, const int32_t* ids, size_t count);
+
+int main(int argc, char** argv)
+{
+    int original = 0, perf = 0;
+    size_t capacity = 0;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "-o") == 0) {
+            original = 1;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            perf = 1;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            capacity = (size_t)strtoul(argv[++i], NULL, 10);
+        } else {
+            break;
+        }
+    }
+    if (i + 1 != argc) {
+        fprintf(stderr,
+            "Usage: %s [-o] [-p] [-c <cache capacity>] <capture file>\n"
+            "  -o  Replay batches at their originally captured pace.\n"
+            "  -p  Report hardware performance counters of each lambda.\n"
+            "  -c  Enable result cache with given capacity.\n",
+            argv[0]);
+        return 2;
+    }
+    uint8_t* data;
+    size_t length;
+    if (read_file(argv[i], &data, &length) != 0) {
+        fprintf(stderr, "Failed to read `%s`.\n", argv[i]);
+        return 1;
+    }
+    // Count batches and lambdas, to be able to allocate room for their
+    // latencies and IDs, and make sure no batch needs a codec to be decoded.
+    size_t batches = 0, lambdas = 0, encoded = 0;
+    {
+        lcm_CaptureRecord r;
+        size_t offset = 0, n;
+        while ((n = lcm_capture_parse(&data[offset], length - offset, &r))) {
+            batches += r.type == LCM_CAPTURE_BATCH;
+            lambdas += r.type == LCM_CAPTURE_LAMBDA;
+            encoded += r.type == LCM_CAPTURE_BATCH
+                && r.batch.encoding != LCM_ENCODING_RAW;
+            if (r.type == LCM_CAPTURE_LAMBDA && r.lambda.warmup.count > 0) {
+                lcm_Batch* warmup
+                    = malloc(r.lambda.warmup.count * sizeof(lcm_Batch));
+                if (warmup == NULL) {
+                    fprintf(stderr, "Out of memory.\n");
+                    return 1;
+                }
+                lcm_capture_warmup(&r, warmup);
+                for (size_t j = 0; j < r.lambda.warmup.count; ++j) {
+                    encoded += warmup[j].encoding != LCM_ENCODING_RAW;
+                }
+                free(warmup);
+            }
+            offset += n;
+        }
+        if (offset != length) {
+            fprintf(stderr, "Ignoring %zu trailing bytes of `%s`.\n",
+                length - offset, argv[i]);
+        }
+        if (encoded > 0) {
+            fprintf(stderr,
+                "Cannot replay `%s`, as %zu of its batches, including warmup "
+                "batches, need codecs to be decoded.\n",
+                argv[i], encoded);
+            return 1;
+        }
+    }
+    Latencies captured = {.values = malloc((batches + 1) * sizeof(uint64_t)) };
+    Latencies replayed = {.values = malloc((batches + 1) * sizeof(uint64_t)) };
+    int32_t* ids = malloc((lambdas + 1) * sizeof(int32_t));
+    size_t ids_count = 0;
+    if (captured.values == NULL || replayed.values == NULL || ids == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+    lua_State* L = luaL_newstate();
+    if (L == NULL) {
+        fprintf(stderr, "Failed to create Lua state.\n");
+        return 1;
+    }
+    luaL_openlibs(L);
+    lcm_openlib(L, &(lcm_Config){
+        .cache = {.capacity = capacity },
+        .perf = perf,
+    });
+
+    // Replay capture.
+    size_t failures = 0, changes = 0;
+    uint64_t first = 0, begin = lcm_time_now();
+    {
+        lcm_CaptureRecord r;
+        size_t offset = 0, n;
+        while ((n = lcm_capture_parse(&data[offset], length - offset, &r))) {
+            offset += n;
+            if (r.type == LCM_CAPTURE_LAMBDA) {
+                lcm_Batch* warmup
+                    = malloc((r.lambda.warmup.count + 1) * sizeof(lcm_Batch));
+                if (warmup == NULL) {
+                    fprintf(stderr, "Out of memory.\n");
+                    return 1;
+                }
+                lcm_capture_warmup(&r, warmup);
+                const int status = lcm_register(L, r.lambda);
+                free(warmup);
+                if (status != 0) {
+                    fprintf(stderr, "Lambda %" PRId32 ": %s\n",
+                        r.lambda.lambda_id, lcm_errstr(status));
+                }
+                size_t j = 0;
+                while (j < ids_count && ids[j] != r.lambda.lambda_id) {
+                    ++j;
+                }
+                if (j == ids_count) {
+                    ids[ids_count++] = r.lambda.lambda_id;
+                }
+                continue;
+            }
+            if (captured.count == 0) {
+                first = r.timestamp;
+                begin = lcm_time_now();
+            } else if (original) {
+                wait_until(begin + (r.timestamp - first));
+            }
+            const uint64_t start = lcm_time_now();
+            const int status = lcm_process(L, r.batch,
+                (lcm_ClosureBatch){.context = NULL, .function = discard });
+            const uint64_t duration = lcm_time_now() - start;
+
+            failures += status != 0;
+            changes += status != r.status;
+            captured.values[captured.count++] = r.duration;
+            captured.total += r.duration;
+            replayed.values[replayed.count++] = duration;
+            replayed.total += duration;
+        }
+    }
+    const uint64_t wall = lcm_time_now() - begin;
+
+    qsort(captured.values, captured.count, sizeof(uint64_t), compare);
+    qsort(replayed.values, replayed.count, sizeof(uint64_t), compare);
+
+    printf("Replayed %zu batches in %.3f s, %s.\n", replayed.count,
+        (double)wall / 1e9, original ? "at original pace" : "at full speed");
+    printf("%zu batches failed, %zu changed status since captured.\n\n",
+        failures, changes);
+    printf("%-24s %14s %14s %9s\n", "", "captured", "replayed", "delta");
+    report("throughput (batches/s)",
+        captured.total > 0 ? captured.count * 1e9 / captured.total : 0.0,
+        replayed.total > 0 ? replayed.count * 1e9 / replayed.total : 0.0);
+    report("latency mean (ns)",
+        captured.count > 0 ? (double)captured.total / captured.count : 0.0,
+        replayed.count > 0 ? (double)replayed.total / replayed.count : 0.0);
+    report("latency p50 (ns)", (double)percentile(&captured, 50),
+        (double)percentile(&replayed, 50));
+    report("latency p99 (ns)", (double)percentile(&captured, 99),
+        (double)percentile(&replayed, 99));
+    report("latency max (ns)", (double)percentile(&captured, 100),
+        (double)percentile(&replayed, 100));
+
+    if (perf) {
+        report_perf(L, ids, ids_count);
+    }
+
+    lua_close(L);
+    free(ids);
+    free(captured.values);
+    free(replayed.values);
+    free(data);
+    return changes > 0 ? 3 : 0;
+}
+
+static int read_file(const char* path, uint8_t** data, size_t* length)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return 1;
+    }
+    size_t capacity = 1 << 16;
+    *data = malloc(capacity);
+    *length = 0;
+    while (*data != NULL) {
+        *length += fread(&(*data)[*length], 1, capacity - *length, file);
+        if (*length < capacity) {
+            break;
+        }
+        uint8_t* grown = realloc(*data, capacity * 2);
+        if (grown == NULL) {
+            free(*data);
+            *data = NULL;
+            break;
+        }
+        *data = grown;
+        capacity *= 2;
+    }
+    const int status = *data == NULL || ferror(file);
+    fclose(file);
+    return status;
+}
+
+static void wait_until(uint64_t t)
+{
+    const uint64_t now = lcm_time_now();
+    if (now < t) {
+        const struct timespec ts = {
+            .tv_sec = (time_t)((t - now) / 1000000000),
+            .tv_nsec = (long)((t - now) % 1000000000),
+        };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void discard(void* context, const lcm_Batch* result)
+{
+    (void)context;
+    (void)result;
+}
+
+static int compare(const void* a, const void* b)
+{
+    const uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Returns `p`th percentile of sorted latencies.
+static uint64_t percentile(const Latencies* l, unsigned p)
+{
+    if (l->count == 0) {
+        return 0;
+    }
+    const size_t i = (l->count * p + 99) / 100;
+    return l->values[i > 0 ? i - 1 : 0];
+}
+
+static void report(const char* name, double captured, double replayed)
+{
+    printf("%-24s %14.1f %14.1f", name, captured, replayed);
+    if (captured > 0.0) {
+        printf(" %+8.1f%%\n", (replayed - captured) * 100.0 / captured);
+    } else {
+        printf(" %9s\n", "-");
+    }
+}
+
+// Reports hardware performance counters of identified lambdas, per call.
+// Prints `value` right-aligned in column of `width`, or "n/a" if unavailable.
+static void print_counter(int width, int precision, int available, double value)
+{
+    if (available) {
+        printf(" %*.*f", width, precision, value);
+    } else {
+        printf(" %*s", width, "n/a");
+    }
+}
+
+static void report_perf(lua_State* L, const int32_t* ids, size_t count)
+{
+    printf("\n%-12s %10s %10s %12s %12s %6s %10s %10s\n", "lambda", "calls",
+        "unmeasured", "cycles", "instructions", "ipc", "llc-miss", "br-miss");
+    for (size_t i = 0; i < count; ++i) {
+        lcm_PerfStats s;
+        const int status = lcm_perfstats(L, ids[i], &s);
+        if (status != 0) {
+            printf("%-12" PRId32 " %s\n", ids[i], lcm_errstr(status));
+            if (status == LCM_ERRNOPERF) {
+                return;
+            }
+            continue;
+        }
+        // Averages are unavailable if no call was measured.
+        const double calls = (double)s.calls;
+        const uint32_t a = s.calls > 0 ? s.available : 0;
+        printf("%-12" PRId32 " %10" PRIu64 " %10" PRIu64, ids[i], s.calls,
+            s.unmeasured);
+        print_counter(12, 1, a & LCM_PERF_FCYCLES, (double)s.cycles / calls);
+        print_counter(12, 1, a & LCM_PERF_FINSTRUCTIONS,
+            (double)s.instructions / calls);
+        print_counter(6, 2,
+            (a & LCM_PERF_FCYCLES) && (a & LCM_PERF_FINSTRUCTIONS)
+                && s.cycles > 0,
+            (double)s.instructions / (double)s.cycles);
+        print_counter(
+            10, 2, a & LCM_PERF_FLLCMISSES, (double)s.llc_misses / calls);
+        print_counter(
+            10, 2, a & LCM_PERF_FBRANCHMISSES, (double)s.branch_misses / calls);
+        printf("\n");
+    }
+}
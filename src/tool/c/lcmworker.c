@@ -0,0 +1,40 @@
+/**
+ * Lua/compute farm worker tool.
+ *
+ * Hosts a Lua state on behalf of a worker farm created using `lcm_farm_new()`,
+ * which starts the tool itself.
+ *
+ * Usage: lcmworker <shared memory fd> <worker index>
+ *
+ * @file
+ */
+#include "../../main/c/lcm.h"
+#include "../../main/c/lcmfarm.h"
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char** argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <shared memory fd> <worker index>\n",
+            argv[0]);
+        return 2;
+    }
+    lua_State* L = luaL_newstate();
+    if (L == NULL) {
+        fprintf(stderr, "Failed to create Lua state.\n");
+        return 1;
+    }
+    luaL_openlibs(L);
+    lcm_openlib(L, NULL);
+
+    const int fd = atoi(argv[1]);
+    const size_t index = (size_t)strtoul(argv[2], NULL, 10);
+    const int status = lcm_farm_serve(L, fd, index);
+    fprintf(stderr, "%s\n", lcm_errstr(status));
+    lua_close(L);
+    return 1;
+}